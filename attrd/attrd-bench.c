@@ -0,0 +1,189 @@
+/*
+  File: attrd-bench.c
+  (Linux Extended Attributes)
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compare setting and getting an attribute on a set of files through
+ * direct system calls and through attrd, in batches.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+#include <attr/xattr.h>
+#include <attr/attrd.h>
+
+#define BENCH_NAME	"user.attrd-bench"
+#define BENCH_VALUE	"0123456789abcdef"
+
+const char *progname;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, unsigned long ops, double secs)
+{
+	printf("%-8s %lu ops in %.3f s, %.0f ops/s\n", what, ops, secs,
+	       secs > 0 ? ops / secs : 0);
+}
+
+static int bench_direct(char *files[], int num_files, int rounds)
+{
+	char value[sizeof(BENCH_VALUE)];
+	int r, n;
+
+	for (r = 0; r < rounds; r++) {
+		for (n = 0; n < num_files; n++) {
+			if (setxattr(files[n], BENCH_NAME, BENCH_VALUE,
+				     sizeof(BENCH_VALUE) - 1, 0) != 0 ||
+			    getxattr(files[n], BENCH_NAME, value,
+				     sizeof(value)) < 0) {
+				fprintf(stderr, "%s: %s: %s\n", progname,
+					files[n], strerror(errno));
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int run_batch(struct attrd *attrd, struct attrd_batch *batch,
+		     char *files[], int first, int count)
+{
+	int ops = 0, n;
+
+	if (attrd_run(attrd, batch) != 0) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		return -1;
+	}
+	for (n = 0; n < count; n++) {
+		if (attrd_result(batch, ops++, NULL, NULL) != 0 ||
+		    attrd_result(batch, ops++, NULL, NULL) != 0) {
+			fprintf(stderr, "%s: %s: %s\n", progname,
+				files[first + n], strerror(errno));
+			return -1;
+		}
+	}
+	attrd_batch_reset(batch);
+	return 0;
+}
+
+static int bench_attrd(struct attrd *attrd, char *files[], int num_files,
+		       int rounds, int batch_size)
+{
+	struct attrd_batch *batch = attrd_batch_new();
+	int r, n, first = 0, status = -1;
+
+	if (!batch) {
+		perror(progname);
+		return -1;
+	}
+	for (r = 0; r < rounds; r++) {
+		for (n = 0; n < num_files; n++) {
+			if (attrd_set(batch, files[n], BENCH_NAME, BENCH_VALUE,
+				      sizeof(BENCH_VALUE) - 1, 0) < 0 ||
+			    attrd_get(batch, files[n], BENCH_NAME, 0) < 0) {
+				perror(progname);
+				goto out;
+			}
+			if (n - first + 1 == batch_size) {
+				if (run_batch(attrd, batch, files, first,
+					      batch_size) != 0)
+					goto out;
+				first = n + 1;
+			}
+		}
+		if (first < num_files &&
+		    run_batch(attrd, batch, files, first,
+			      num_files - first) != 0)
+			goto out;
+		first = 0;
+	}
+	status = 0;
+
+out:
+	attrd_batch_free(batch);
+	return status;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *socket_path = NULL;
+	int opt, rounds = 10, batch_size = 256, n;
+	struct attrd *attrd;
+	double start;
+
+	progname = argv[0];
+	while ((opt = getopt(argc, argv, "s:b:n:")) != -1) {
+		switch(opt) {
+			case 's':
+				socket_path = optarg;
+				break;
+
+			case 'b':
+				batch_size = atoi(optarg);
+				break;
+
+			case 'n':
+				rounds = atoi(optarg);
+				break;
+
+			default:
+				goto synopsis;
+		}
+	}
+	if (optind == argc || batch_size < 1 || rounds < 1)
+		goto synopsis;
+
+	attrd = attrd_connect(socket_path);
+	if (!attrd) {
+		fprintf(stderr, "%s: %s: %s\n", progname,
+			socket_path ? socket_path : attrd_socket_path(),
+			strerror(errno));
+		return 1;
+	}
+
+	start = now();
+	if (bench_direct(argv + optind, argc - optind, rounds) != 0)
+		return 1;
+	report("direct", 2UL * rounds * (argc - optind), now() - start);
+
+	start = now();
+	if (bench_attrd(attrd, argv + optind, argc - optind, rounds,
+			batch_size) != 0)
+		return 1;
+	report("attrd", 2UL * rounds * (argc - optind), now() - start);
+
+	for (n = optind; n < argc; n++)
+		removexattr(argv[n], BENCH_NAME);
+	attrd_disconnect(attrd);
+	return 0;
+
+synopsis:
+	fprintf(stderr, "Usage: %s [-s socket] [-b batch] [-n rounds] "
+			"file...\n", progname);
+	return 2;
+}
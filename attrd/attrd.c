@@ -0,0 +1,735 @@
+/*
+  File: attrd.c
+  (Linux Extended Attributes)
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * A daemon which performs batches of extended attribute operations for
+ * clients connected to a Unix domain socket, see <attr/attrd.h> for the
+ * protocol. Only clients running under the same user ID as the daemon
+ * are served.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <locale.h>
+#include <errno.h>
+
+#include <attr/xattr.h>
+#include <attr/libattr.h>
+#include <attr/attrd.h>
+#include "config.h"
+#include "misc.h"
+#include "work_queue.h"
+#include "fs_caps.h"
+
+#define CMD_LINE_OPTIONS "s:j:"
+#define CMD_LINE_SPEC "[-s socket] [-j jobs]"
+
+struct option long_options[] = {
+	{ "socket",	1, 0, 's' },
+	{ "jobs",	1, 0, 'j' },
+	{ "version",	0, 0, 'V' },
+	{ "help",	0, 0, 'H' },
+	{ NULL,		0, 0, 0 }
+};
+
+const char *opt_socket;  /* socket path */
+int opt_jobs = 4;  /* worker threads */
+unsigned int opt_min_jobs;  /* adapt between this and opt_jobs, or 0 */
+
+const char *progname;
+volatile sig_atomic_t terminate;
+
+#define ATTRD_QUEUE_SIZE	16  /* connections queued per worker */
+#define ATTRD_FD_CACHE		32  /* open files per request */
+#define ATTRD_VALUE_MAX		(64 << 10)  /* largest value or name list */
+
+#define ATTRD_OP_HEADER		(2 * sizeof(uint8_t) + sizeof(uint16_t) + \
+				 2 * sizeof(uint32_t))
+#define ATTRD_RESULT_HEADER	(sizeof(int32_t) + sizeof(uint32_t))
+
+/*
+ * A client connection. Its socket is nonblocking: the main loop reads a
+ * request as it arrives, and only hands the connection to a worker once
+ * the request is complete, so that a stalled client cannot hold up a
+ * worker. While the request is processed, the connection is busy and the
+ * main loop does not poll it. The worker starts sending the response, and
+ * the main loop sends what is left before reading the next request.
+ */
+struct conn {
+	int fd;
+	unsigned long id;
+	int busy, dead;
+	char *req, *resp, *path, *name, *dst;
+	size_t req_size, req_len, resp_size, resp_len, resp_sent;
+	size_t path_size, name_size, dst_size;
+};
+
+/* Workers return connections to the main loop through this pipe. */
+int wake_pipe[2];
+
+/*
+ * Files which are accessed repeatedly within a request are only opened
+ * once. Files are not kept open across requests, as the paths may refer
+ * to different files by then.
+ */
+struct fd_cache_entry {
+	char *path;
+	int flags;
+	int fd;
+	dev_t dev;
+};
+
+struct fd_cache {
+	struct fd_cache_entry entries[ATTRD_FD_CACHE];
+	unsigned int next;
+};
+
+/*
+ * Return a file descriptor for PATH, opening it if necessary. The
+ * descriptor KEEP is not evicted from the cache.
+ */
+static int cached_fd(struct fd_cache *cache, const char *path, int flags,
+		     dev_t *dev, int keep)
+{
+	struct fd_cache_entry *e;
+	struct stat st;
+	unsigned int n;
+	char *p;
+	int fd;
+
+	flags &= ATTRD_NOFOLLOW;
+	for (n = 0; n < ATTRD_FD_CACHE; n++) {
+		e = &cache->entries[n];
+		if (e->path && e->flags == flags &&
+		    strcmp(e->path, path) == 0) {
+			*dev = e->dev;
+			return e->fd;
+		}
+	}
+
+	fd = open(path, O_PATH | O_CLOEXEC |
+			((flags & ATTRD_NOFOLLOW) ? O_NOFOLLOW : 0));
+	if (fd < 0)
+		return -1;
+	p = strdup(path);
+	if (!p || fstat(fd, &st) != 0) {
+		free(p);
+		close(fd);
+		return -1;
+	}
+
+	e = &cache->entries[cache->next];
+	if (e->path && e->fd == keep) {
+		cache->next = (cache->next + 1) % ATTRD_FD_CACHE;
+		e = &cache->entries[cache->next];
+	}
+	cache->next = (cache->next + 1) % ATTRD_FD_CACHE;
+	if (e->path) {
+		free(e->path);
+		close(e->fd);
+	}
+	e->path = p;
+	e->flags = flags;
+	e->fd = fd;
+	e->dev = *dev = st.st_dev;
+	return fd;
+}
+
+static void fd_cache_free(struct fd_cache *cache)
+{
+	unsigned int n;
+
+	for (n = 0; n < ATTRD_FD_CACHE; n++) {
+		struct fd_cache_entry *e = &cache->entries[n];
+
+		if (e->path) {
+			free(e->path);
+			close(e->fd);
+		}
+	}
+}
+
+static int copy_string(char **buf, size_t *size, const char *str, size_t len)
+{
+	if (high_water_alloc((void **)buf, size, len + 1))
+		return -1;
+	memcpy(*buf, str, len);
+	(*buf)[len] = '\0';
+	return 0;
+}
+
+/*
+ * Perform one operation. The data of the result, if any, is placed at
+ * DATA, which has room for DATA_MAX bytes. Results which would fit into
+ * ATTRD_VALUE_MAX bytes but not into DATA_MAX fail with E2BIG. Returns 0
+ * or an errno value.
+ */
+static int do_op(struct conn *c, struct fd_cache *cache, int op, int flags,
+		 const char *value, size_t value_len, char *data,
+		 size_t data_max, size_t *data_len)
+{
+	int fd, dst_fd, xflags = 0;
+	dev_t dev, dst_dev;
+	ssize_t ret;
+
+	*data_len = 0;
+	fd = cached_fd(cache, c->path, flags, &dev, -1);
+	if (fd < 0)
+		return errno;
+	/*
+	 * Once an operation failed with EOPNOTSUPP, later operations in the
+	 * same namespace on the same filesystem fail without a system call.
+	 * There is nothing to copy from filesystems without attributes.
+	 */
+	if (op == ATTRD_COPY) {
+		if (fs_caps(dev, (flags & ATTRD_NOFOLLOW) ? NULL : c->path) &
+		    FS_CAPS_NO_XATTR)
+			return 0;
+	} else if (fs_caps_unsupported(dev, c->name))
+		return EOPNOTSUPP;
+
+	/* A size of 0 would only query the size. */
+	if ((op == ATTRD_GET || op == ATTRD_LIST) && data_max == 0)
+		return E2BIG;
+	switch (op) {
+		case ATTRD_GET:
+			ret = attr_getxattrat(fd, "", AT_EMPTY_PATH, c->name,
+					      data, data_max);
+			break;
+
+		case ATTRD_LIST:
+			ret = attr_listxattrat(fd, "", AT_EMPTY_PATH, data,
+					       data_max);
+			break;
+
+		case ATTRD_SET:
+			if (flags & ATTRD_CREATE)
+				xflags |= XATTR_CREATE;
+			if (flags & ATTRD_REPLACE)
+				xflags |= XATTR_REPLACE;
+			ret = attr_setxattrat(fd, "", AT_EMPTY_PATH, c->name,
+					      value, value_len, xflags);
+			break;
+
+		case ATTRD_REMOVE:
+			ret = attr_removexattrat(fd, "", AT_EMPTY_PATH,
+						 c->name);
+			break;
+
+		case ATTRD_COPY:
+			if (copy_string(&c->dst, &c->dst_size, value,
+					value_len))
+				return errno;
+			dst_fd = cached_fd(cache, c->dst, flags, &dst_dev,
+					   fd);
+			if (dst_fd < 0)
+				return errno;
+			ret = attr_copy_fileat(fd, "", dst_fd, "", NULL, NULL);
+			break;
+
+		default:
+			return EINVAL;
+	}
+	if (ret < 0) {
+		if (errno == EOPNOTSUPP && op != ATTRD_COPY)
+			fs_caps_set_unsupported(dev, c->name);
+		if (errno == ERANGE && data_max < ATTRD_VALUE_MAX)
+			return E2BIG;
+		return errno;
+	}
+	if (op == ATTRD_GET || op == ATTRD_LIST)
+		*data_len = ret;
+	return 0;
+}
+
+/*
+ * Process the request in c->req, after its size, and build the response
+ * in c->resp.
+ * Returns -1 for malformed requests. The response never exceeds
+ * ATTRD_MAX_MESSAGE: room is kept for the result headers of all
+ * operations, and results which do not fit into what is left fail with
+ * E2BIG.
+ */
+static int process_request(struct conn *c)
+{
+	const char *p = c->req + sizeof(uint32_t), *end = c->req + c->req_len;
+	struct fd_cache cache;
+	uint32_t num_ops, n, resp_size;
+	int status = -1;
+
+	if ((size_t)(end - p) < sizeof(num_ops))
+		return -1;
+	memcpy(&num_ops, p, sizeof(num_ops));
+	p += sizeof(num_ops);
+	if (num_ops > (size_t)(end - p) / ATTRD_OP_HEADER)
+		return -1;
+
+	memset(&cache, 0, sizeof(cache));
+	c->resp_len = 2 * sizeof(uint32_t);
+	for (n = 0; n < num_ops; n++) {
+		uint8_t op, flags;
+		uint16_t name_len;
+		uint32_t path_len, value_len, len;
+		const char *path, *name, *value;
+		char *result;
+		size_t used, data_max, data_len;
+		int32_t error;
+
+		if ((size_t)(end - p) < ATTRD_OP_HEADER)
+			goto out;
+		op = *p++;
+		flags = *p++;
+		memcpy(&name_len, p, sizeof(name_len));
+		p += sizeof(name_len);
+		memcpy(&path_len, p, sizeof(path_len));
+		p += sizeof(path_len);
+		memcpy(&value_len, p, sizeof(value_len));
+		p += sizeof(value_len);
+		if ((size_t)(end - p) < (size_t)path_len + name_len + value_len)
+			goto out;
+		path = p;
+		name = path + path_len;
+		value = name + name_len;
+		p = value + value_len;
+
+		used = c->resp_len - sizeof(resp_size) +
+		       (size_t)(num_ops - n) * ATTRD_RESULT_HEADER;
+		data_max = used < ATTRD_MAX_MESSAGE ?
+			   ATTRD_MAX_MESSAGE - used : 0;
+		if (data_max > ATTRD_VALUE_MAX)
+			data_max = ATTRD_VALUE_MAX;
+		if (high_water_alloc((void **)&c->resp, &c->resp_size,
+				     c->resp_len + ATTRD_RESULT_HEADER +
+				     data_max) ||
+		    copy_string(&c->path, &c->path_size, path, path_len) ||
+		    copy_string(&c->name, &c->name_size, name, name_len))
+			goto out;
+		result = c->resp + c->resp_len;
+		error = do_op(c, &cache, op, flags, value, value_len,
+			      result + ATTRD_RESULT_HEADER, data_max,
+			      &data_len);
+		len = data_len;
+		memcpy(result, &error, sizeof(error));
+		memcpy(result + sizeof(error), &len, sizeof(len));
+		c->resp_len += ATTRD_RESULT_HEADER + len;
+	}
+	if (p != end)
+		goto out;
+
+	resp_size = c->resp_len - sizeof(resp_size);
+	memcpy(c->resp, &resp_size, sizeof(resp_size));
+	memcpy(c->resp + sizeof(resp_size), &num_ops, sizeof(num_ops));
+	status = 0;
+
+out:
+	fd_cache_free(&cache);
+	return status;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	while (len) {
+		ssize_t done = read(fd, buf, len);
+
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done <= 0)
+			return -1;
+		buf = (char *)buf + done;
+		len -= done;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	while (len) {
+		ssize_t done = write(fd, buf, len);
+
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done < 0)
+			return -1;
+		buf = (const char *)buf + done;
+		len -= done;
+	}
+	return 0;
+}
+
+/*
+ * Read as much of a request as is available. Returns 1 when the request
+ * is complete, 0 when more is to come, and -1 when the connection is to
+ * be closed.
+ */
+static int read_request(struct conn *c)
+{
+	uint32_t size;
+	size_t want;
+	ssize_t done;
+
+	for (;;) {
+		want = sizeof(size);
+		if (c->req_len >= sizeof(size)) {
+			memcpy(&size, c->req, sizeof(size));
+			if (size > ATTRD_MAX_MESSAGE)
+				return -1;
+			want += size;
+			if (c->req_len == want)
+				return 1;
+		}
+		if (high_water_alloc((void **)&c->req, &c->req_size, want))
+			return -1;
+		done = read(c->fd, c->req + c->req_len, want - c->req_len);
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (done <= 0)
+			return -1;
+		c->req_len += done;
+	}
+}
+
+/*
+ * Send as much of the response as the socket takes without blocking.
+ */
+static int send_response(struct conn *c)
+{
+	while (c->resp_sent < c->resp_len) {
+		ssize_t done = write(c->fd, c->resp + c->resp_sent,
+				     c->resp_len - c->resp_sent);
+
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (done < 0)
+			return -1;
+		c->resp_sent += done;
+	}
+	return 0;
+}
+
+static void handle_request(void *item, void *unused)
+{
+	struct conn *c = item;
+
+	c->resp_sent = 0;
+	if (process_request(c) != 0 || send_response(c) != 0)
+		c->dead = 1;
+	c->req_len = 0;
+
+	/* Hand the connection back to the main loop. */
+	if (write_all(wake_pipe[1], &c, sizeof(c)) != 0) {
+		perror(progname);
+		exit(1);
+	}
+}
+
+static void free_conn(struct conn *c)
+{
+	close(c->fd);
+	free(c->req);
+	free(c->resp);
+	free(c->path);
+	free(c->name);
+	free(c->dst);
+	free(c);
+}
+
+static int same_user(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+	       cred.uid == geteuid();
+}
+
+static int listen_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	mode_t mask;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	/* Replace stale sockets, but not those of a running daemon. */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+			close(fd);
+			errno = EADDRINUSE;
+			return -1;
+		}
+		unlink(path);
+	}
+	mask = umask(077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    listen(fd, SOMAXCONN) != 0) {
+		int err = errno;
+
+		umask(mask);
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	umask(mask);
+	return fd;
+}
+
+static void sig_terminate(int sig)
+{
+	terminate = 1;
+}
+
+static void drop_conn(struct conn **conns, size_t *num_conns,
+		      struct conn *c)
+{
+	size_t n;
+
+	for (n = 0; conns[n] != c; n++)
+		;
+	conns[n] = conns[--*num_conns];
+	free_conn(c);
+}
+
+static int serve(int listen_fd, struct work_queue *wq)
+{
+	struct conn **conns = NULL;
+	struct pollfd *pfds = NULL;
+	size_t conns_size = 0, pfds_size = 0, num_conns = 0, n, m;
+	unsigned long next_id = 0;
+
+	while (!terminate) {
+		struct conn *c;
+		int num_pfds = 2;
+
+		if (high_water_alloc((void **)&pfds, &pfds_size,
+				     (num_conns + 2) * sizeof(*pfds)))
+			goto nomem;
+		pfds[0].fd = listen_fd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = wake_pipe[0];
+		pfds[1].events = POLLIN;
+		for (n = 0; n < num_conns; n++) {
+			c = conns[n];
+			if (c->busy)
+				continue;
+			pfds[num_pfds].fd = c->fd;
+			pfds[num_pfds].events =
+				c->resp_sent < c->resp_len ? POLLOUT : POLLIN;
+			num_pfds++;
+		}
+		if (poll(pfds, num_pfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror(progname);
+			return 1;
+		}
+
+		/* Pick up connections which workers are done with. */
+		if (pfds[1].revents) {
+			if (read_all(wake_pipe[0], &c, sizeof(c)) != 0) {
+				perror(progname);
+				return 1;
+			}
+			c->busy = 0;
+			if (c->dead)
+				drop_conn(conns, &num_conns, c);
+		}
+
+		/*
+		 * Finish sending responses, read requests, and hand the
+		 * connections with complete requests to the workers.
+		 */
+		for (n = 2; n < (size_t)num_pfds; n++) {
+			if (!pfds[n].revents)
+				continue;
+			for (m = 0; conns[m]->fd != pfds[n].fd; m++)
+				;
+			c = conns[m];
+			if (c->resp_sent < c->resp_len) {
+				if (send_response(c) != 0)
+					drop_conn(conns, &num_conns, c);
+				continue;
+			}
+			switch (read_request(c)) {
+				case -1:
+					drop_conn(conns, &num_conns, c);
+					break;
+
+				case 1:
+					c->busy = 1;
+					work_queue_add(wq, c, c->id);
+					break;
+			}
+		}
+
+		if (pfds[0].revents) {
+			int fd = accept4(listen_fd, NULL, NULL,
+					 SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+			if (fd < 0)
+				continue;
+			if (!same_user(fd)) {
+				close(fd);
+				continue;
+			}
+			c = calloc(1, sizeof(*c));
+			if (!c || high_water_alloc((void **)&conns, &conns_size,
+					(num_conns + 1) * sizeof(*conns))) {
+				free(c);
+				close(fd);
+				continue;
+			}
+			c->fd = fd;
+			c->id = next_id++;
+			conns[num_conns++] = c;
+		}
+	}
+	return 0;
+
+nomem:
+	perror(progname);
+	return 1;
+}
+
+void help(void)
+{
+	printf(_("%s %s -- extended attribute daemon\n"),
+	       progname, VERSION);
+	printf(_("Usage: %s %s\n"), progname, _(CMD_LINE_SPEC));
+	printf(_(
+"  -s, --socket=path       listen on this socket\n"
+"  -j, --jobs=n            use n worker threads; with min-max or auto,\n"
+"                          adapt the number of busy threads to the load\n"
+"      --version           print version and exit\n"
+"      --help              this help text\n"));
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction sa;
+	struct work_queue *wq;
+	int opt, listen_fd, status;
+
+	progname = basename(argv[0]);
+
+	setlocale(LC_CTYPE, "");
+	setlocale(LC_MESSAGES, "");
+	bindtextdomain(PACKAGE, LOCALEDIR);
+	textdomain(PACKAGE);
+
+	while ((opt = getopt_long(argc, argv, CMD_LINE_OPTIONS,
+		                  long_options, NULL)) != -1) {
+		switch(opt) {
+			case 's':  /* socket path */
+				opt_socket = optarg;
+				break;
+
+			case 'j': {  /* worker threads */
+				unsigned int max;
+
+				if (work_queue_parse_threads(optarg,
+						&opt_min_jobs, &max) != 0)
+					goto synopsis;
+				opt_jobs = max;
+				break;
+			}
+
+			case 'V':
+				printf("%s " VERSION "\n", progname);
+				return 0;
+
+			case 'H':
+				help();
+				return 0;
+
+			default:
+				goto synopsis;
+		}
+	}
+	if (optind != argc)
+		goto synopsis;
+	if (!opt_socket)
+		opt_socket = attrd_socket_path();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_terminate;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (pipe2(wake_pipe, O_CLOEXEC) != 0) {
+		perror(progname);
+		return 1;
+	}
+	listen_fd = listen_socket(opt_socket);
+	if (listen_fd < 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, opt_socket,
+			strerror(errno));
+		return 1;
+	}
+	/* Requests on one connection must be answered in order. */
+	wq = work_queue_create(opt_jobs, ATTRD_QUEUE_SIZE, WORK_QUEUE_KEYED,
+			       handle_request, NULL);
+	if (wq && opt_min_jobs && work_queue_adapt(wq, opt_min_jobs) != 0) {
+		work_queue_finish(wq);
+		wq = NULL;
+	}
+	if (!wq) {
+		perror(progname);
+		unlink(opt_socket);
+		return 1;
+	}
+
+	status = serve(listen_fd, wq);
+
+	unlink(opt_socket);
+	close(listen_fd);
+	work_queue_finish(wq);
+	return status;
+
+synopsis:
+	fprintf(stderr, _("Usage: %s %s\n"
+	                  "Try `%s --help' for more information.\n"),
+		progname, _(CMD_LINE_SPEC), progname);
+	return 2;
+}
@@ -0,0 +1,1075 @@
+/*
+  File: attrindex.c
+  (Linux Extended Attributes)
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * attrindex maintains an index of the extended attributes of the files
+ * in a set of trees, and looks up which files carry a given attribute
+ * (or attribute value) without touching the trees themselves.
+ *
+ * The index is a single file which is mapped for lookups. After a header,
+ * it contains a table of all files seen, sorted by path, a table of all
+ * attribute names, sorted by name, and for each name a list of the files
+ * which carry it (the postings). With --values, a 64-bit hash of the
+ * value is kept next to each posting. All integers are in host byte
+ * order; strings live in a string table at the end.
+ *
+ * When an index is updated, files whose device, inode number and change
+ * time are unchanged take their attributes from the old index instead of
+ * from the filesystem. Setting or removing an attribute updates the
+ * change time, so only files which were modified are read again. A file
+ * whose change time is not before the time the old index was scanned
+ * may have been modified again within the same timestamp granularity
+ * after it was read, so it is always read again.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <getopt.h>
+#include <locale.h>
+
+#include <attr/xattr.h>
+#include "config.h"
+#include "walk_tree.h"
+#include "name_match.h"
+#include "output.h"
+#include "misc.h"
+
+#define CMD_LINE_OPTIONS "um:hLP0"
+#define CMD_LINE_SPEC1 "-u [-hLP] [-m pattern] [--values] index [path...]"
+#define CMD_LINE_SPEC2 "[-0] index name[==value]..."
+
+struct option long_options[] = {
+	{ "update",		0, 0, 'u' },
+	{ "match",		1, 0, 'm' },
+	{ "values",		0, 0, 'v' },
+	{ "no-dereference",	0, 0, 'h' },
+	{ "logical",		0, 0, 'L' },
+	{ "physical",		0, 0, 'P' },
+	{ "null",		0, 0, '0' },
+	{ "version",		0, 0, 'V' },
+	{ "help",		0, 0, 'H' },
+	{ NULL,			0, 0, 0 }
+};
+
+#define INDEX_MAGIC	"attridx"
+#define INDEX_VERSION	1
+
+#define INDEX_VALUES	0x01  /* value hashes are included */
+
+struct index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t walk_flags;
+	uint32_t scan_start;  /* in seconds; 0 in older indexes */
+	uint64_t num_files, num_names, num_postings, num_roots;
+	uint64_t files, names, hashes, roots, postings;  /* offsets */
+	uint64_t strings, strings_size;
+	uint64_t pattern;  /* --match pattern, in the strings */
+};
+
+struct index_file {
+	uint64_t dev, ino;
+	int64_t ctime_sec;
+	uint64_t ctime_nsec;
+	uint64_t path;  /* in the strings */
+};
+
+struct index_name {
+	uint64_t name;  /* in the strings */
+	uint64_t first, count;  /* range of postings */
+};
+
+/* A mapped index. */
+struct index {
+	const char *map;
+	size_t size;
+	const struct index_header *header;
+	const struct index_file *files;
+	const struct index_name *names;
+	const uint64_t *hashes;
+	const uint64_t *roots;
+	const uint32_t *postings;
+	const char *strings;
+};
+
+/* The index being built. */
+struct file {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctime;
+	size_t first, count;  /* range of attrs */
+};
+
+struct attr {
+	uint32_t name;  /* index into names */
+	uint64_t hash;
+};
+
+int opt_update;  /* create or update the index */
+const char *opt_name_pattern = "^user\\.";  /* include only matching names */
+int opt_values;  /* include value hashes */
+int opt_null;  /* print '\0'-terminated paths */
+int walk_flags = WALK_TREE_RECURSIVE | WALK_TREE_DEREFERENCE;
+
+struct name_match name_matcher;
+time_t scan_start;  /* when the trees were scanned */
+struct index old_index;  /* index being updated, if any */
+size_t *old_attrs_first;  /* attributes of each file in the old index */
+const char **old_attr_names;
+uint64_t *old_attr_hashes;
+
+struct file *files;
+size_t num_files, files_size;
+struct attr *attrs;
+size_t num_attrs, attrs_size;
+char **names;
+size_t num_names, names_size;
+uint32_t *name_table;  /* hash table of names: name index + 1, or 0 */
+size_t name_table_size;
+
+const char *progname;
+int had_errors;
+
+static uint64_t hash_bytes(const void *data, size_t len)
+{
+	const unsigned char *d = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;  /* FNV-1a */
+
+	while (len--) {
+		hash ^= *d++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static const char *xquote(const char *str, const char *quote_chars)
+{
+	const char *q = quote(str, quote_chars);
+	if (q == NULL) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		exit(1);
+	}
+	return q;
+}
+
+static void nomem(void)
+{
+	fprintf(stderr, "%s: %s\n", progname, strerror(ENOMEM));
+	exit(1);
+}
+
+/*
+ * Reading an index
+ */
+
+static const char *index_string(const struct index *index, uint64_t offset)
+{
+	if (offset >= index->header->strings_size)
+		return NULL;
+	return index->strings + offset;
+}
+
+static int index_section(const struct index *index, uint64_t offset,
+			 uint64_t num, size_t size)
+{
+	return offset % 8 == 0 && offset <= index->size &&
+	       num <= (index->size - offset) / size;
+}
+
+int open_index(struct index *index, const char *filename)
+{
+	const struct index_header *h;
+	struct stat st;
+	int fd;
+
+	memset(index, 0, sizeof(*index));
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0)
+		goto fail;
+	if (st.st_size < (off_t)sizeof(*h))
+		goto invalid;
+	index->size = st.st_size;
+	index->map = mmap(NULL, index->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (index->map == MAP_FAILED) {
+		index->map = NULL;
+		goto fail;
+	}
+	close(fd);
+	fd = -1;
+
+	h = index->header = (const struct index_header *)index->map;
+	if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->version != INDEX_VERSION ||
+	    !index_section(index, h->files, h->num_files,
+			   sizeof(*index->files)) ||
+	    !index_section(index, h->names, h->num_names,
+			   sizeof(*index->names)) ||
+	    ((h->flags & INDEX_VALUES) &&
+	     !index_section(index, h->hashes, h->num_postings,
+			    sizeof(*index->hashes))) ||
+	    !index_section(index, h->roots, h->num_roots,
+			   sizeof(*index->roots)) ||
+	    !index_section(index, h->postings, h->num_postings,
+			   sizeof(*index->postings)) ||
+	    h->strings > index->size ||
+	    h->strings_size != index->size - h->strings ||
+	    h->strings_size == 0 ||
+	    index->map[index->size - 1] != '\0')
+		goto invalid;
+	index->files = (const void *)(index->map + h->files);
+	index->names = (const void *)(index->map + h->names);
+	if (h->flags & INDEX_VALUES)
+		index->hashes = (const void *)(index->map + h->hashes);
+	index->roots = (const void *)(index->map + h->roots);
+	index->postings = (const void *)(index->map + h->postings);
+	index->strings = index->map + h->strings;
+	if (!index_string(index, h->pattern))
+		goto invalid;
+	return 0;
+
+invalid:
+	errno = EINVAL;
+fail:
+	if (fd >= 0)
+		close(fd);
+	if (index->map)
+		munmap((void *)index->map, index->size);
+	index->map = NULL;
+	return -1;
+}
+
+void close_index(struct index *index)
+{
+	if (index->map)
+		munmap((void *)index->map, index->size);
+	index->map = NULL;
+}
+
+static void invalid_index(const char *filename)
+{
+	fprintf(stderr, _("%s: %s: Index is corrupt\n"), progname, filename);
+	exit(1);
+}
+
+/*
+ * Find the old index entry for PATH, or return -1.
+ */
+static long find_old_file(const char *path)
+{
+	const struct index_header *h = old_index.header;
+	size_t lo = 0, hi = h->num_files;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const char *p = index_string(&old_index,
+					     old_index.files[mid].path);
+		int cmp;
+
+		if (!p)
+			return -1;
+		cmp = strcmp(path, p);
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+static long find_name(const struct index *index, const char *name)
+{
+	size_t lo = 0, hi = index->header->num_names;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const char *n = index_string(index, index->names[mid].name);
+		int cmp;
+
+		if (!n)
+			return -1;
+		cmp = strcmp(name, n);
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+/*
+ * Invert the postings of the old index, so that the attributes of each
+ * of its files can be looked up.
+ */
+static int load_old_attrs(const char *filename)
+{
+	const struct index_header *h = old_index.header;
+	size_t n, p, *fill;
+
+	old_attrs_first = calloc(h->num_files + 1, sizeof(*old_attrs_first));
+	old_attr_names = malloc((h->num_postings + 1) *
+				sizeof(*old_attr_names));
+	old_attr_hashes = malloc((h->num_postings + 1) *
+				 sizeof(*old_attr_hashes));
+	fill = calloc(h->num_files + 1, sizeof(*fill));
+	if (!old_attrs_first || !old_attr_names || !old_attr_hashes || !fill)
+		nomem();
+
+	for (p = 0; p < h->num_postings; p++) {
+		if (old_index.postings[p] >= h->num_files)
+			invalid_index(filename);
+		old_attrs_first[old_index.postings[p] + 1]++;
+	}
+	for (n = 0; n < h->num_files; n++)
+		old_attrs_first[n + 1] += old_attrs_first[n];
+	for (n = 0; n < h->num_names; n++) {
+		const struct index_name *name = &old_index.names[n];
+		const char *str = index_string(&old_index, name->name);
+
+		if (!str || name->first > h->num_postings ||
+		    name->count > h->num_postings - name->first)
+			invalid_index(filename);
+		for (p = name->first; p < name->first + name->count; p++) {
+			uint32_t f = old_index.postings[p];
+			size_t slot = old_attrs_first[f] + fill[f]++;
+
+			old_attr_names[slot] = str;
+			old_attr_hashes[slot] = old_index.hashes ?
+						old_index.hashes[p] : 0;
+		}
+	}
+	free(fill);
+	return 0;
+}
+
+/*
+ * Building an index
+ */
+
+static int grow_name_table(void)
+{
+	size_t size = name_table_size ? 2 * name_table_size : 1024, n;
+	uint32_t *table = calloc(size, sizeof(*table));
+
+	if (!table)
+		return -1;
+	for (n = 0; n < num_names; n++) {
+		size_t h = hash_bytes(names[n], strlen(names[n])) & (size - 1);
+
+		while (table[h])
+			h = (h + 1) & (size - 1);
+		table[h] = n + 1;
+	}
+	free(name_table);
+	name_table = table;
+	name_table_size = size;
+	return 0;
+}
+
+static uint32_t intern_name(const char *name)
+{
+	size_t h, mask;
+
+	if (2 * (num_names + 1) > name_table_size && grow_name_table() != 0)
+		nomem();
+	mask = name_table_size - 1;
+	for (h = hash_bytes(name, strlen(name)) & mask; name_table[h];
+	     h = (h + 1) & mask)
+		if (strcmp(names[name_table[h] - 1], name) == 0)
+			return name_table[h] - 1;
+	if (high_water_alloc((void **)&names, &names_size,
+			     (num_names + 1) * sizeof(*names)))
+		nomem();
+	names[num_names] = strdup(name);
+	if (!names[num_names])
+		nomem();
+	name_table[h] = ++num_names;
+	return num_names - 1;
+}
+
+static void add_attr(const char *name, uint64_t hash)
+{
+	if (high_water_alloc((void **)&attrs, &attrs_size,
+			     (num_attrs + 1) * sizeof(*attrs)))
+		nomem();
+	attrs[num_attrs].name = intern_name(name);
+	attrs[num_attrs].hash = hash;
+	num_attrs++;
+	files[num_files - 1].count++;
+}
+
+static ssize_t do_listxattr(const char *path, char *list, size_t size)
+{
+	return ((walk_flags & WALK_TREE_DEREFERENCE) ?
+		listxattr : llistxattr)(path, list, size);
+}
+
+static ssize_t do_getxattr(const char *path, const char *name, void *value,
+			   size_t size)
+{
+	return ((walk_flags & WALK_TREE_DEREFERENCE) ?
+		getxattr : lgetxattr)(path, name, value, size);
+}
+
+static void read_error(const char *path, const char *name)
+{
+	if (name)
+		fprintf(stderr, "%s: %s: %s: %s\n", progname,
+			xquote(path, "\n\r"), xquote(name, "\n\r"),
+			strerror(errno));
+	else
+		fprintf(stderr, "%s: %s: %s\n", progname,
+			xquote(path, "\n\r"), strerror(errno));
+	had_errors++;
+}
+
+static void read_attrs(const char *path)
+{
+	static char *list, *value;
+	static size_t list_size, value_size;
+	ssize_t length;
+	char *l;
+
+	length = -1;
+	if (list_size)
+		length = do_listxattr(path, list, list_size);
+	if (length < 0 && (!list_size || errno == ERANGE)) {
+		length = do_listxattr(path, NULL, 0);
+		if (length > 0) {
+			if (high_water_alloc((void **)&list, &list_size,
+					     length))
+				nomem();
+			length = do_listxattr(path, list, list_size);
+		}
+	}
+	if (length < 0) {
+		if (errno != ENOTSUP)
+			read_error(path, NULL);
+		return;
+	}
+
+	for (l = list; l < list + length; l += strlen(l) + 1) {
+		uint64_t hash = 0;
+
+		if (!name_match(&name_matcher, l, strlen(l)))
+			continue;
+		if (opt_values) {
+			ssize_t size = -1;
+
+			if (value_size)
+				size = do_getxattr(path, l, value, value_size);
+			if (size < 0 && (!value_size || errno == ERANGE)) {
+				size = do_getxattr(path, l, NULL, 0);
+				if (size >= 0 &&
+				    high_water_alloc((void **)&value,
+						     &value_size, size + 1))
+					nomem();
+				if (size >= 0)
+					size = do_getxattr(path, l, value,
+							   value_size);
+			}
+			if (size < 0) {
+				if (errno != ENODATA)
+					read_error(path, l);
+				continue;
+			}
+			hash = hash_bytes(value, size);
+		}
+		add_attr(l, hash);
+	}
+}
+
+static int index_file(const char *path, const struct stat *st, int flags,
+		      void *unused)
+{
+	struct file *file;
+	long old;
+
+	if (flags & WALK_TREE_FAILED) {
+		read_error(path, NULL);
+		return 0;
+	}
+	if (high_water_alloc((void **)&files, &files_size,
+			     (num_files + 1) * sizeof(*files)))
+		nomem();
+	file = &files[num_files++];
+	file->path = strdup(path);
+	if (!file->path)
+		nomem();
+	file->dev = st->st_dev;
+	file->ino = st->st_ino;
+	file->ctime = st->st_ctim;
+	file->first = num_attrs;
+	file->count = 0;
+
+	/* Unchanged files keep their attributes from the old index. */
+	old = old_index.map ? find_old_file(path) : -1;
+	if (old >= 0) {
+		const struct index_file *f = &old_index.files[old];
+
+		if (f->dev == (uint64_t)st->st_dev &&
+		    f->ino == (uint64_t)st->st_ino &&
+		    f->ctime_sec == (int64_t)st->st_ctim.tv_sec &&
+		    f->ctime_nsec == (uint64_t)st->st_ctim.tv_nsec &&
+		    f->ctime_sec < (int64_t)old_index.header->scan_start) {
+			size_t n;
+
+			for (n = old_attrs_first[old];
+			     n < old_attrs_first[old + 1]; n++)
+				add_attr(old_attr_names[n], old_attr_hashes[n]);
+			return 0;
+		}
+	}
+	read_attrs(path);
+	return 0;
+}
+
+/*
+ * Writing an index
+ */
+
+struct posting {
+	uint32_t name, file;  /* sorted indexes */
+	uint64_t hash;
+};
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(files[*(const size_t *)a].path,
+		      files[*(const size_t *)b].path);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(names[*(const size_t *)a], names[*(const size_t *)b]);
+}
+
+static int compare_postings(const void *a, const void *b)
+{
+	const struct posting *pa = a, *pb = b;
+
+	if (pa->name != pb->name)
+		return pa->name < pb->name ? -1 : 1;
+	if (pa->file != pb->file)
+		return pa->file < pb->file ? -1 : 1;
+	return 0;
+}
+
+struct strings {
+	char *buf;
+	size_t size, len;
+};
+
+static uint64_t add_string(struct strings *strings, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	uint64_t offset = strings->len;
+
+	if (high_water_alloc((void **)&strings->buf, &strings->size,
+			     strings->len + len))
+		nomem();
+	memcpy(strings->buf + strings->len, str, len);
+	strings->len += len;
+	return offset;
+}
+
+static int write_section(FILE *file, uint64_t *offset, const void *data,
+			 size_t size)
+{
+	static const char zeros[8];
+	size_t pad = (8 - *offset % 8) % 8;
+
+	if (pad && fwrite(zeros, pad, 1, file) != 1)
+		return -1;
+	*offset += pad;
+	if (size && fwrite(data, size, 1, file) != 1)
+		return -1;
+	*offset += size;
+	return 0;
+}
+
+int write_index(const char *filename, char *roots[], int num_roots)
+{
+	struct index_header h;
+	struct index_file *ifiles = NULL;
+	struct index_name *inames = NULL;
+	struct posting *postings = NULL;
+	uint64_t *hashes = NULL, *iroots = NULL, offset;
+	uint32_t *ipostings = NULL;
+	size_t *file_order, *file_rank, *name_order, *name_rank, n, f, a;
+	struct strings strings = { NULL, 0, 0 };
+	char *tmp;
+	FILE *file = NULL;
+	int fd, status = -1;
+
+	file_order = malloc((num_files + 1) * sizeof(*file_order));
+	file_rank = malloc((num_files + 1) * sizeof(*file_rank));
+	name_order = malloc((num_names + 1) * sizeof(*name_order));
+	name_rank = malloc((num_names + 1) * sizeof(*name_rank));
+	ifiles = malloc((num_files + 1) * sizeof(*ifiles));
+	inames = malloc((num_names + 1) * sizeof(*inames));
+	postings = malloc((num_attrs + 1) * sizeof(*postings));
+	ipostings = malloc((num_attrs + 1) * sizeof(*ipostings));
+	hashes = malloc((num_attrs + 1) * sizeof(*hashes));
+	iroots = malloc((num_roots + 1) * sizeof(*iroots));
+	if (!file_order || !file_rank || !name_order || !name_rank ||
+	    !ifiles || !inames || !postings || !ipostings || !hashes ||
+	    !iroots)
+		nomem();
+
+	for (n = 0; n < num_files; n++)
+		file_order[n] = n;
+	qsort(file_order, num_files, sizeof(*file_order), compare_paths);
+	for (n = 0; n < num_names; n++)
+		name_order[n] = n;
+	qsort(name_order, num_names, sizeof(*name_order), compare_names);
+
+	/* Strings are only stored once: names first, then paths. */
+	for (n = 0; n < num_names; n++) {
+		name_rank[name_order[n]] = n;
+		inames[n].name = add_string(&strings, names[name_order[n]]);
+	}
+	for (n = 0; n < num_files; n++) {
+		const struct file *file = &files[file_order[n]];
+
+		file_rank[file_order[n]] = n;
+		ifiles[n].dev = file->dev;
+		ifiles[n].ino = file->ino;
+		ifiles[n].ctime_sec = file->ctime.tv_sec;
+		ifiles[n].ctime_nsec = file->ctime.tv_nsec;
+		ifiles[n].path = add_string(&strings, file->path);
+	}
+	for (n = 0; n < (size_t)num_roots; n++)
+		iroots[n] = add_string(&strings, roots[n]);
+
+	for (f = 0, n = 0; f < num_files; f++) {
+		for (a = files[f].first;
+		     a < files[f].first + files[f].count; a++, n++) {
+			postings[n].name = name_rank[attrs[a].name];
+			postings[n].file = file_rank[f];
+			postings[n].hash = attrs[a].hash;
+		}
+	}
+	qsort(postings, num_attrs, sizeof(*postings), compare_postings);
+	for (n = 0; n < num_names; n++)
+		inames[n].count = 0;
+	for (a = 0, n = 0; a < num_attrs; a++) {
+		/* A file lists each name only once. */
+		if (a && postings[a].name == postings[a - 1].name &&
+		    postings[a].file == postings[a - 1].file)
+			continue;
+		if (inames[postings[a].name].count++ == 0)
+			inames[postings[a].name].first = n;
+		ipostings[n] = postings[a].file;
+		hashes[n] = postings[a].hash;
+		n++;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+	h.version = INDEX_VERSION;
+	h.flags = opt_values ? INDEX_VALUES : 0;
+	h.walk_flags = walk_flags;
+	h.scan_start = scan_start;
+	h.num_files = num_files;
+	h.num_names = num_names;
+	h.num_postings = n;
+	h.num_roots = num_roots;
+	h.pattern = add_string(&strings, opt_name_pattern);
+
+	/* Compute the layout; write_section() pads to 8 bytes. */
+	offset = sizeof(h);
+	h.files = offset;
+	offset += num_files * sizeof(*ifiles);
+	h.names = offset;
+	offset += num_names * sizeof(*inames);
+	h.hashes = offset;
+	if (opt_values)
+		offset += h.num_postings * sizeof(*hashes);
+	h.roots = offset;
+	offset += num_roots * sizeof(*iroots);
+	h.postings = offset;
+	offset += h.num_postings * sizeof(*ipostings);
+	h.strings = (offset + 7) & ~7ULL;
+	h.strings_size = strings.len;
+
+	/* Write to a temporary file and rename it into place. */
+	tmp = malloc(strlen(filename) + 8);
+	if (!tmp)
+		nomem();
+	sprintf(tmp, "%s.XXXXXX", filename);
+	fd = mkstemp(tmp);
+	if (fd >= 0) {
+		mode_t mask = umask(0);
+
+		umask(mask);
+		fchmod(fd, 0666 & ~mask);
+	}
+	if (fd < 0 || !(file = fdopen(fd, "w"))) {
+		fprintf(stderr, "%s: %s: %s\n", progname, tmp,
+			strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		goto out;
+	}
+	offset = 0;
+	if (write_section(file, &offset, &h, sizeof(h)) ||
+	    write_section(file, &offset, ifiles,
+			  num_files * sizeof(*ifiles)) ||
+	    write_section(file, &offset, inames,
+			  num_names * sizeof(*inames)) ||
+	    (opt_values &&
+	     write_section(file, &offset, hashes,
+			   h.num_postings * sizeof(*hashes))) ||
+	    write_section(file, &offset, iroots,
+			  num_roots * sizeof(*iroots)) ||
+	    write_section(file, &offset, ipostings,
+			  h.num_postings * sizeof(*ipostings)) ||
+	    write_section(file, &offset, strings.buf, strings.len) ||
+	    fflush(file) != 0 || fsync(fileno(file)) != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, tmp,
+			strerror(errno));
+		fclose(file);
+		unlink(tmp);
+		goto out;
+	}
+	fclose(file);
+	if (rename(tmp, filename) != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, filename,
+			strerror(errno));
+		unlink(tmp);
+		goto out;
+	}
+	status = 0;
+
+out:
+	free(tmp);
+	free(strings.buf);
+	free(iroots);
+	free(hashes);
+	free(ipostings);
+	free(postings);
+	free(inames);
+	free(ifiles);
+	free(name_rank);
+	free(name_order);
+	free(file_rank);
+	free(file_order);
+	return status;
+}
+
+int update(const char *filename, char *paths[], int num_paths)
+{
+	char **roots = paths;
+	int n;
+
+	if (open_index(&old_index, filename) != 0) {
+		if (errno == EINVAL) {
+			fprintf(stderr, _("%s: %s: Not a valid index\n"),
+				progname, filename);
+			return 1;
+		}
+		if (errno != ENOENT || num_paths == 0) {
+			fprintf(stderr, "%s: %s: %s\n", progname, filename,
+				strerror(errno));
+			return 1;
+		}
+	}
+
+	if (old_index.map && num_paths == 0) {
+		/* Refresh the trees the index was built from. */
+		const struct index_header *h = old_index.header;
+
+		num_paths = h->num_roots;
+		roots = malloc((num_paths + 1) * sizeof(*roots));
+		if (!roots)
+			nomem();
+		for (n = 0; n < num_paths; n++) {
+			const char *root = index_string(&old_index,
+							old_index.roots[n]);
+
+			if (!root)
+				invalid_index(filename);
+			roots[n] = strdup(root);
+			if (!roots[n])
+				nomem();
+		}
+		opt_name_pattern = strdup(index_string(&old_index,
+						       h->pattern));
+		if (!opt_name_pattern)
+			nomem();
+		opt_values = !!(h->flags & INDEX_VALUES);
+		walk_flags = h->walk_flags;
+	}
+
+	if (name_match_compile(&name_matcher, opt_name_pattern) != 0) {
+		fprintf(stderr, _("%s: invalid regular expression \"%s\"\n"),
+			progname, opt_name_pattern);
+		return 1;
+	}
+
+	/* An old index built differently cannot be reused. */
+	if (old_index.map &&
+	    (!!(old_index.header->flags & INDEX_VALUES) != opt_values ||
+	     old_index.header->walk_flags != (uint32_t)walk_flags ||
+	     strcmp(index_string(&old_index, old_index.header->pattern),
+		    opt_name_pattern) != 0))
+		close_index(&old_index);
+	if (old_index.map)
+		load_old_attrs(filename);
+
+	scan_start = time(NULL);
+	for (n = 0; n < num_paths; n++)
+		walk_tree(roots[n], walk_flags, 0, index_file, NULL);
+
+	if (write_index(filename, roots, num_paths) != 0)
+		had_errors++;
+	close_index(&old_index);
+	return had_errors ? 1 : 0;
+}
+
+/*
+ * Looking up files
+ */
+
+struct term {
+	long name;  /* in the index */
+	int has_value;
+	uint64_t hash;
+};
+
+int lookup(const char *filename, char *args[], int num_args)
+{
+	const struct index_header *h;
+	struct index index;
+	struct term *terms;
+	struct output out;
+	uint32_t *matches = NULL;
+	size_t num_matches = 0, n;
+	int t;
+
+	if (open_index(&index, filename) != 0) {
+		if (errno == EINVAL)
+			fprintf(stderr, _("%s: %s: Not a valid index\n"),
+				progname, filename);
+		else
+			fprintf(stderr, "%s: %s: %s\n", progname, filename,
+				strerror(errno));
+		return 1;
+	}
+	h = index.header;
+
+	terms = calloc(num_args, sizeof(*terms));
+	if (!terms)
+		nomem();
+	for (t = 0; t < num_args; t++) {
+		char *arg = args[t], *value = strstr(arg, "==");
+
+		if (value) {
+			ssize_t size;
+
+			*value = '\0';
+			value += 2;
+			if (!(h->flags & INDEX_VALUES)) {
+				fprintf(stderr, _("%s: %s: Index has no "
+						  "values\n"),
+					progname, filename);
+				return 1;
+			}
+			size = decode_value(value, strlen(value), value);
+			if (size < 0) {
+				fprintf(stderr, "%s: %s: %s\n", progname,
+					value, strerror(errno));
+				return 1;
+			}
+			terms[t].has_value = 1;
+			terms[t].hash = hash_bytes(value, size);
+		}
+		terms[t].name = find_name(&index, unquote(arg));
+		if (terms[t].name < 0)
+			goto print;  /* no file has this name */
+	}
+
+	/*
+	 * Postings are sorted by file, so the files which match all terms
+	 * are found by merging.
+	 */
+	for (t = 0; t < num_args; t++) {
+		const struct index_name *name = &index.names[terms[t].name];
+		size_t m = 0, k = 0, p;
+
+		if (name->first > h->num_postings ||
+		    name->count > h->num_postings - name->first)
+			invalid_index(filename);
+		if (t == 0) {
+			matches = malloc((name->count + 1) * sizeof(*matches));
+			if (!matches)
+				nomem();
+		}
+		for (p = name->first; p < name->first + name->count; p++) {
+			uint32_t file = index.postings[p];
+
+			if (terms[t].has_value &&
+			    index.hashes[p] != terms[t].hash)
+				continue;
+			if (t == 0) {
+				matches[m++] = file;
+				continue;
+			}
+			while (k < num_matches && matches[k] < file)
+				k++;
+			if (k < num_matches && matches[k] == file)
+				matches[m++] = file;
+		}
+		num_matches = m;
+	}
+
+print:
+	if (output_open(&out, "-") != 0) {
+		perror(progname);
+		return 1;
+	}
+	for (n = 0; n < num_matches; n++) {
+		const char *path;
+
+		if (matches[n] >= h->num_files)
+			invalid_index(filename);
+		path = index_string(&index, index.files[matches[n]].path);
+		if (!path)
+			invalid_index(filename);
+		if (output_puts(&out, path) != 0 ||
+		    output_write(&out, opt_null ? "" : "\n", 1) != 0)
+			break;
+	}
+	if (output_close(&out) != 0) {
+		perror(progname);
+		return 1;
+	}
+	free(matches);
+	free(terms);
+	close_index(&index);
+	return num_matches ? 0 : 1;
+}
+
+void help(void)
+{
+	printf(_("%s %s -- index extended attributes\n"), progname, VERSION);
+	printf(_("Usage: %s %s\n"), progname, _(CMD_LINE_SPEC1));
+	printf(_("       %s %s\n"), progname, _(CMD_LINE_SPEC2));
+	printf(_(
+"  -u, --update            create or update the index\n"
+"  -m, --match=pattern     only index attributes with names matching pattern\n"
+"      --values            also index the values\n"
+"  -h, --no-dereference    do not dereference symbolic links\n"
+"  -L, --logical           logical walk, follow symbolic links\n"
+"  -P  --physical          physical walk, do not follow symbolic links\n"
+"  -0, --null              print file names terminated by NUL\n"
+"      --version           print version and exit\n"
+"      --help              this help text\n"));
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	progname = basename(argv[0]);
+
+	setlocale(LC_CTYPE, "");
+	setlocale(LC_MESSAGES, "");
+	bindtextdomain(PACKAGE, LOCALEDIR);
+	textdomain(PACKAGE);
+
+	while ((opt = getopt_long(argc, argv, CMD_LINE_OPTIONS,
+		                  long_options, NULL)) != -1) {
+		switch(opt) {
+			case 'u':  /* create or update the index */
+				opt_update = 1;
+				break;
+
+			case 'm':  /* regular expression for filtering names */
+				opt_name_pattern = optarg;
+				if (strcmp(opt_name_pattern, "-") == 0)
+					opt_name_pattern = "";
+				break;
+
+			case 'v':  /* index value hashes */
+				opt_values = 1;
+				break;
+
+			case 'h':  /* do not dereference symlinks */
+				walk_flags &= ~WALK_TREE_DEREFERENCE;
+				break;
+
+			case 'L':
+				walk_flags |= WALK_TREE_LOGICAL;
+				walk_flags &= ~WALK_TREE_PHYSICAL;
+				break;
+
+			case 'P':
+				walk_flags |= WALK_TREE_PHYSICAL;
+				walk_flags &= ~WALK_TREE_LOGICAL;
+				break;
+
+			case '0':  /* NUL terminated output */
+				opt_null = 1;
+				break;
+
+			case 'V':
+				printf("%s " VERSION "\n", progname);
+				return 0;
+
+			case 'H':
+				help();
+				return 0;
+
+			default:
+				goto synopsis;
+		}
+	}
+	if (optind >= argc || (!opt_update && optind + 1 >= argc))
+		goto synopsis;
+
+	if (opt_update)
+		return update(argv[optind], argv + optind + 1,
+			      argc - optind - 1);
+	return lookup(argv[optind], argv + optind + 1, argc - optind - 1);
+
+synopsis:
+	fprintf(stderr, _("Usage: %s %s\n"
+			  "       %s %s\n"
+	                  "Try `%s --help' for more information.\n"),
+		progname, _(CMD_LINE_SPEC1), progname, _(CMD_LINE_SPEC2),
+		progname);
+	return 2;
+}
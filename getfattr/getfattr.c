@@ -19,21 +19,33 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <errno.h>
 #include <ctype.h>
 #include <getopt.h>
-#include <regex.h>
 #include <locale.h>
+#include <math.h>
+#include <time.h>
 
 #include <attr/xattr.h>
 #include "config.h"
 #include "walk_tree.h"
+#include "name_match.h"
+#include "output.h"
+#include "input.h"
+#include "inode_set.h"
+#include "rate_limit.h"
 #include "misc.h"
 
-#define CMD_LINE_OPTIONS "n:de:m:hRLP"
+#define CMD_LINE_OPTIONS "n:de:m:hRLP0"
 #define CMD_LINE_SPEC "[-hRLP] [-n name|-d] [-e en] [-m pattern] path..."
 
 struct option long_options[] = {
@@ -47,6 +59,23 @@ struct option long_options[] = {
 	{ "recursive",		0, 0, 'R' },
 	{ "logical",		0, 0, 'L' },
 	{ "physical",		0, 0, 'P' },
+	{ "output",		1, 0, 'O' },
+	{ "files-from",		1, 0, 'F' },
+	{ "null",		0, 0, '0' },
+	{ "where",		1, 0, 'W' },
+	{ "has",		1, 0, 'A' },
+	{ "value-size",		1, 0, 'Z' },
+	{ "summarize",		2, 0, 'S' },
+	{ "inline-fit",		2, 0, 'I' },
+	{ "sample",		1, 0, 'r' },
+	{ "seed",		1, 0, 'D' },
+	{ "hardlinks",		0, 0, 'l' },
+	{ "skip-fs",		1, 0, 'K' },
+	{ "shard",		1, 0, 'T' },
+	{ "merge",		0, 0, 'M' },
+	{ "max-ops-per-sec",	1, 0, 'o' },
+	{ "max-bytes-per-sec",	1, 0, 'b' },
+	{ "idle",		0, 0, 'i' },
 	{ "version",		0, 0, 'V' },
 	{ "help",		0, 0, 'H' },
 	{ NULL,			0, 0, 0 }
@@ -60,11 +89,127 @@ char *opt_encoding;  /* encode values automatically (NULL), or as "text",
                         "hex", or "base64" */
 char opt_value_only;  /* dump the value only, without any decoration */
 int opt_strip_leading_slash = 1;  /* strip leading '/' from path names */
+char *opt_output = "-";  /* output file */
+const char *opt_files_from;  /* read path names from file */
+int opt_null;  /* path names are terminated by '\0' */
+
+/*
+ * Query predicates. A file matches if it has all the attributes named
+ * in --has and --where, their values compare as requested, and (with
+ * --value-size) one of the attributes selected by --match has a value
+ * of the requested size.
+ */
+#define QUERY_HAS	0
+#define QUERY_EQUAL	1
+#define QUERY_DIFFERENT	2
+#define QUERY_CONTAINS	3
+
+struct query {
+	int op;
+	const char *name;
+	char *value;
+	size_t size;
+};
+struct query *queries;
+int num_queries;
+int opt_value_size_cmp;  /* '+' for larger, '-' for smaller, 0 for equal */
+long long opt_value_size = -1;  /* value size to match, or -1 */
+
+/*
+ * With --summarize, the attributes of each subtree are added up instead
+ * of printed. walk_tree() visits directories before their contents, so
+ * the directories which contain the current path form a stack; a
+ * directory is complete once the walk leaves it.
+ *
+ * With --inline-fit, the space which the attributes of each file take up
+ * in the inode is estimated from the layout rules of the filesystem, and
+ * the files whose attributes do not fit are added up instead.
+ */
+struct usage {
+	unsigned long long attrs, name_bytes, value_bytes;
+	unsigned long long overflows, footprint;  /* files not fitting */
+	unsigned long long decisive;  /* files which would fit without name */
+};
+
+/*
+ * With --sample, walk_tree() only visits a random fraction p of the
+ * entries in each directory (see walk_tree_sample()). A subtree's totals
+ * are then estimated from those of the entries visited, each weighted by
+ * 1/p (Horvitz-Thompson); the variance of the estimate is accumulated
+ * along with it, one sampling stage per directory level.
+ */
+#define EST_FILES	0
+#define EST_TAGGED	1  /* files with matching attributes */
+#define EST_ATTRS	2
+#define EST_NAME_BYTES	3
+#define EST_VALUE_BYTES	4
+#define NUM_EST		5
+
+struct estimate {
+	double total[NUM_EST], var[NUM_EST];
+};
+
+struct subtree {
+	char *path;
+	size_t len;
+	struct usage usage;
+	struct estimate estimate;  /* with --sample */
+	double weight;  /* inverse probability of visiting the subtree */
+};
+
+struct name_usage {
+	char *name;
+	struct usage usage;
+	double weighted[3];  /* attrs, name and value bytes, with --sample */
+};
+
+int opt_summarize;  /* number of heaviest subtrees to report, or 0 */
+struct subtree *subtrees;  /* directories containing the current path */
+size_t num_subtrees, subtrees_size;
+struct subtree *heaviest;  /* sorted by decreasing size */
+int num_heaviest;
+struct name_usage *name_usages;  /* hash table */
+size_t num_name_usages, name_usages_size;
+
+#define FIT_EXT4	1
+#define FIT_XFS		2
+
+#define EXT4_SUPER_MAGIC	0xEF53
+#define XFS_SUPER_MAGIC		0x58465342
+
+struct attr_size {
+	const char *name;
+	size_t size;
+	int matched;  /* by --match */
+};
+
+double opt_sample = 1;  /* fraction of entries to visit */
+unsigned long long opt_seed;  /* for choosing the entries to visit */
+int have_seed;
+struct estimate sample_estimate;  /* of all pathnames */
+
+int opt_fit;  /* estimate if attributes fit into the inode */
+
+int opt_merge;  /* merge the output of --shard runs */
+
+double opt_max_ops, opt_max_bytes;  /* per second, or 0 */
+int fit_type;  /* filesystem layout, or 0 to detect */
+int fit_inode_size;  /* inode size, or 0 for the default */
+
+/*
+ * With --hardlinks, files with more than one link are only read once;
+ * later links refer to the first. The value kept for each inode tells
+ * whether anything was printed for it.
+ */
+#define LINKS_MAX_BYTES	(64 << 20)
+
+struct inode_set *links;
 
 const char *progname;
 int absolute_warning;
 int had_errors;
-regex_t name_regex;
+struct name_match name_matcher;
+struct output output;
 
 
 static const char *xquote(const char *str, const char *quote_chars)
@@ -77,16 +222,59 @@ static const char *xquote(const char *str, const char *quote_chars)
 	return q;
 }
 
-int do_getxattr(const char *path, const char *name, void *value, size_t size)
+static void xoutput(int error)
 {
-	return ((walk_flags & WALK_TREE_DEREFERENCE) ?
-		getxattr : lgetxattr)(path, name, value, size);
+	if (error) {
+		const char *name = opt_output;
+
+		if (strcmp(name, "-") == 0)
+			name = _("standard output");
+		fprintf(stderr, "%s: %s: %s\n", progname, name,
+			strerror(errno));
+		exit(1);
+	}
 }
 
-int do_listxattr(const char *path, char *list, size_t size)
+static void output_line(const char *str1, const char *str2, const char *str3)
 {
-	return ((walk_flags & WALK_TREE_DEREFERENCE) ?
-		listxattr : llistxattr)(path, list, size);
+	xoutput(output_puts(&output, str1));
+	if (str2)
+		xoutput(output_puts(&output, str2));
+	if (str3)
+		xoutput(output_puts(&output, str3));
+	xoutput(output_write(&output, "\n", 1));
+}
+
+/*
+ * Files are accessed through FD when do_print() managed to open them,
+ * and by PATH otherwise. Each call counts towards --max-ops-per-sec, and
+ * the data it returns towards --max-bytes-per-sec.
+ */
+int do_getxattr(const char *path, int fd, const char *name, void *value,
+		size_t size)
+{
+	int ret;
+
+	if (fd >= 0)
+		ret = fgetxattr(fd, name, value, size);
+	else
+		ret = ((walk_flags & WALK_TREE_DEREFERENCE) ?
+		       getxattr : lgetxattr)(path, name, value, size);
+	rate_limit(1, (size && ret > 0) ? ret : 0);
+	return ret;
+}
+
+int do_listxattr(const char *path, int fd, char *list, size_t size)
+{
+	int ret;
+
+	if (fd >= 0)
+		ret = flistxattr(fd, list, size);
+	else
+		ret = ((walk_flags & WALK_TREE_DEREFERENCE) ?
+		       listxattr : llistxattr)(path, list, size);
+	rate_limit(1, (size && ret > 0) ? ret : 0);
+	return ret;
 }
 
 const char *strerror_ea(int err)
@@ -220,36 +408,8 @@ const char *encode(const char *value, size_t *size)
 	return encoded;
 }
 
-int print_attribute(const char *path, const char *name, int *header_printed)
+const char *strip_path(const char *path)
 {
-	static char *value;
-	static size_t value_size;
-	int rval = 0;
-	size_t length = 0;
-
-	if (opt_dump || opt_value_only) {
-		rval = do_getxattr(path, name, NULL, 0);
-		if (rval < 0) {
-			fprintf(stderr, "%s: ", xquote(path, "\n\r"));
-			fprintf(stderr, "%s: %s\n", xquote(name, "\n\r"),
-				strerror_ea(errno));
-			return 1;
-		}
-		if (high_water_alloc((void **)&value, &value_size, rval)) {
-			perror(progname);
-			had_errors++;
-			return 1;
-		}
-		rval = do_getxattr(path, name, value, value_size);
-		if (rval < 0) {
-			fprintf(stderr, "%s: ", xquote(path, "\n\r"));
-			fprintf(stderr, "%s: %s\n", xquote(name, "\n\r"),
-				strerror_ea(errno));
-			return 1;
-		}
-		length = rval;
-	}
-
 	if (opt_strip_leading_slash) {
 		if (*path == '/') {
 			if (!absolute_warning) {
@@ -266,62 +426,130 @@ int print_attribute(const char *path, const char *name, int *header_printed)
 		if (*path == '\0')
 			path = ".";
 	}
+	return path;
+}
+
+int print_attribute(const char *path, int fd, const char *name,
+		    int *header_printed)
+{
+	static char *value;
+	static size_t value_size;
+	int rval = 0;
+	size_t length = 0;
+
+	if (opt_dump || opt_value_only) {
+		/*
+		 * Most values fit into the buffer left over from earlier
+		 * attributes; only ask for the size when they don't.
+		 */
+		rval = -1;
+		if (value_size)
+			rval = do_getxattr(path, fd, name, value, value_size);
+		if (rval < 0 && (!value_size || errno == ERANGE)) {
+			rval = do_getxattr(path, fd, name, NULL, 0);
+			if (rval < 0) {
+				fprintf(stderr, "%s: ", xquote(path, "\n\r"));
+				fprintf(stderr, "%s: %s\n",
+					xquote(name, "\n\r"),
+					strerror_ea(errno));
+				return 1;
+			}
+			if (high_water_alloc((void **)&value, &value_size,
+					     rval)) {
+				perror(progname);
+				had_errors++;
+				return 1;
+			}
+			rval = do_getxattr(path, fd, name, value, value_size);
+		}
+		if (rval < 0) {
+			fprintf(stderr, "%s: ", xquote(path, "\n\r"));
+			fprintf(stderr, "%s: %s\n", xquote(name, "\n\r"),
+				strerror_ea(errno));
+			return 1;
+		}
+		length = rval;
+	}
 
 	if (!*header_printed && !opt_value_only) {
-		printf("# file: %s\n", xquote(path, "\n\r"));
+		output_line("# file: ", xquote(strip_path(path), "\n\r"), NULL);
 		*header_printed = 1;
 	}
 
 	if (opt_value_only)
-		fwrite(value, length, 1, stdout);
+		xoutput(output_write(&output, value, length));
 	else if (length) {
 		const char *enc = encode(value, &length);
 		
 		if (enc)
-			printf("%s=%s\n", xquote(name, "=\n\r"), enc);
+			output_line(xquote(name, "=\n\r"), "=", enc);
 	} else
-		puts(xquote(name, "=\n\r"));
+		output_line(xquote(name, "=\n\r"), NULL, NULL);
 
 	return 0;
 }
 
-int list_attributes(const char *path, int *header_printed)
+/*
+ * Read the list of attribute names into a static buffer. Returns the
+ * length of the list, or -1 after reporting an error.
+ */
+ssize_t read_names(const char *path, int fd, char **names)
 {
 	static char *list;
 	static size_t list_size;
-	static char **names;
-	static size_t names_size;
-	int num_names = 0;
 	ssize_t length;
-	char *l;
 
-	length = do_listxattr(path, NULL, 0);
-	if (length < 0) {
-		fprintf(stderr, "%s: %s: %s\n", progname, xquote(path, "\n\r"),
-			strerror_ea(errno));
-		had_errors++;
-		return 1;
-	} else if (length == 0)
-		return 0;
-		
-	if (high_water_alloc((void **)&list, &list_size, length)) {
-		perror(progname);
-		had_errors++;
-		return 1;
-	}
+	*names = list;
+	length = -1;
+	if (list_size)
+		length = do_listxattr(path, fd, list, list_size);
+	if (length < 0 && (!list_size || errno == ERANGE)) {
+		length = do_listxattr(path, fd, NULL, 0);
+		if (length < 0) {
+			fprintf(stderr, "%s: %s: %s\n", progname,
+				xquote(path, "\n\r"), strerror_ea(errno));
+			had_errors++;
+			return -1;
+		} else if (length == 0)
+			return 0;
+
+		if (high_water_alloc((void **)&list, &list_size, length)) {
+			perror(progname);
+			had_errors++;
+			return -1;
+		}
+		*names = list;
 
-	length = do_listxattr(path, list, list_size);
+		length = do_listxattr(path, fd, list, list_size);
+	}
 	if (length < 0) {
 		perror(xquote(path, "\n\r"));
 		had_errors++;
-		return 1;
+		return -1;
 	}
+	return length;
+}
 
-	for (l = list; l != list + length; l = strchr(l, '\0')+1) {
-		if (*l == '\0')	/* not a name, kernel bug */
+int list_attributes(const char *path, int fd, int *header_printed)
+{
+	static char **names;
+	static size_t names_size;
+	int num_names = 0;
+	ssize_t length;
+	char *list, *l, *end;
+
+	length = read_names(path, fd, &list);
+	if (length < 0)
+		return 1;
+
+	for (l = list; l != list + length; l = end + 1) {
+		end = memchr(l, '\0', list + length - l);
+		if (!end)  /* unterminated name, kernel bug */
+			break;
+		if (end == l)	/* not a name, kernel bug */
 			continue;
 
-		if (regexec(&name_regex, l, 0, NULL, 0) != 0)
+		if (!name_match(&name_matcher, l, end - l))
 			continue;
 
 		if (names_size < (num_names+1) * sizeof(*names)) {
@@ -342,15 +570,234 @@ int list_attributes(const char *path, int *header_printed)
 		int n;
 
 		for (n = 0; n < num_names; n++)
-			print_attribute(path, names[n], header_printed);
+			print_attribute(path, fd, names[n], header_printed);
 	}
 	return 0;
 }
 
+static int list_has_name(const char *list, ssize_t length, const char *name)
+{
+	const char *l;
+
+	for (l = list; l < list + length; l += strlen(l) + 1)
+		if (strcmp(l, name) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * Compare the value of attribute QUERY->name with QUERY->value. Only
+ * QUERY->size bytes are fetched; longer values fail with ERANGE and
+ * differ.
+ */
+static int query_compare(const char *path, int fd, const struct query *query)
+{
+	static char *value;
+	static size_t value_size;
+	ssize_t length;
+
+	if (query->op == QUERY_CONTAINS) {
+		length = do_getxattr(path, fd, query->name, NULL, 0);
+		if (length >= 0 &&
+		    high_water_alloc((void **)&value, &value_size, length + 1))
+			return -1;
+		if (length >= 0)
+			length = do_getxattr(path, fd, query->name, value,
+					     length);
+		if (length < 0)
+			return (errno == ENODATA || errno == ERANGE) ? 0 : -1;
+		return query->size == 0 ||
+		       memmem(value, length, query->value, query->size);
+	}
+
+	if (high_water_alloc((void **)&value, &value_size, query->size + 1))
+		return -1;
+	length = do_getxattr(path, fd, query->name, value, query->size);
+	if (length < 0 && errno != ERANGE && errno != ENODATA)
+		return -1;
+	if (length == (ssize_t)query->size &&
+	    memcmp(value, query->value, query->size) == 0)
+		return query->op == QUERY_EQUAL;
+	return query->op == QUERY_DIFFERENT;
+}
+
+static int query_value_size(const char *path, int fd, const char *list,
+			    ssize_t length)
+{
+	const char *l;
+
+	for (l = list; l < list + length; l += strlen(l) + 1) {
+		ssize_t size;
+
+		if (!name_match(&name_matcher, l, strlen(l)))
+			continue;
+		size = do_getxattr(path, fd, l, NULL, 0);
+		if (size < 0)
+			continue;
+		if (opt_value_size_cmp == '+' ? size > opt_value_size :
+		    opt_value_size_cmp == '-' ? size < opt_value_size :
+		    size == opt_value_size)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Evaluate the query predicates. The names are checked first, against
+ * a single listxattr() by path; the file is only opened (through *FD,
+ * if FD is not NULL) when values need to be looked at. Returns 1 if the
+ * file matches, 0 if not, and -1 on errors.
+ */
+int query_match(const char *path, int *fd)
+{
+	char *list;
+	ssize_t length;
+	int n, ret;
+
+	length = read_names(path, -1, &list);
+	if (length < 0)
+		return -1;
+	for (n = 0; n < num_queries; n++)
+		if (!list_has_name(list, length, queries[n].name))
+			return 0;
+	if (length == 0 && opt_value_size >= 0)
+		return 0;
+
+	if (fd && *fd < 0)
+		*fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+	for (n = 0; n < num_queries; n++) {
+		if (queries[n].op == QUERY_HAS)
+			continue;
+		ret = query_compare(path, fd ? *fd : -1, &queries[n]);
+		if (ret < 0) {
+			fprintf(stderr, "%s: %s: %s: %s\n", progname,
+				xquote(path, "\n\r"),
+				xquote(queries[n].name, "\n\r"),
+				strerror_ea(errno));
+			had_errors++;
+		}
+		if (ret <= 0)
+			return ret;
+	}
+	if (opt_value_size >= 0)
+		return query_value_size(path, fd ? *fd : -1, list, length);
+	return 1;
+}
+
+static int add_query(int op, const char *arg)
+{
+	static const char *ops[] = { "==", "!=", "*=" };
+	static const int query_ops[] = {
+		QUERY_EQUAL, QUERY_DIFFERENT, QUERY_CONTAINS
+	};
+	struct query *query;
+	const char *value = NULL;
+	char *name;
+	size_t n;
+
+	query = realloc(queries, (num_queries + 1) * sizeof(*queries));
+	if (!query)
+		return -1;
+	queries = query;
+	query = &queries[num_queries];
+	memset(query, 0, sizeof(*query));
+	query->op = op;
+	if (op == QUERY_HAS)
+		name = strdup(arg);
+	else {
+		/* The first operator in ARG separates the name and value. */
+		for (n = 0; n < sizeof(ops) / sizeof(*ops); n++) {
+			char *o = strstr(arg, ops[n]);
+
+			if (o && (!value || o < value)) {
+				value = o;
+				query->op = query_ops[n];
+			}
+		}
+		if (!value || value == arg) {
+			errno = EINVAL;
+			return -1;
+		}
+		name = strndup(arg, value - arg);
+		value += 2;
+		query->value = malloc(strlen(value) + 1);
+		if (!name || !query->value)
+			goto fail;
+		query->size = decode_value(value, strlen(value), query->value);
+		if ((ssize_t)query->size < 0)
+			goto fail;
+	}
+	if (!name)
+		return -1;
+	query->name = unquote(name);
+	num_queries++;
+	return 0;
+
+fail:
+	free(name);
+	free(query->value);
+	return -1;
+}
+
+static int is_link(const struct stat *stat)
+{
+	/* Bare values have no room for references. */
+	return links && !opt_value_only && !S_ISDIR(stat->st_mode) &&
+	       stat->st_nlink > 1;
+}
+
+/*
+ * Print the name of a file which matched the queries. Names are printed
+ * like in "# file:" lines; with -0, they are not quoted.
+ */
+static void print_match(const char *path)
+{
+	path = strip_path(path);
+	if (opt_null)
+		xoutput(output_write(&output, path, strlen(path) + 1));
+	else
+		output_line(xquote(path, "\n\r"), NULL, NULL);
+}
+
+/*
+ * Print a reference to the first link of a file seen before, if anything
+ * was printed for it.
+ */
+static void print_link(const char *path, const char *first, int printed)
+{
+	char *copy;
+
+	if (!printed)
+		return;
+	if ((num_queries || opt_value_size >= 0) && !opt_dump) {
+		/* A query matched the first link. */
+		print_match(path);
+	} else {
+		/* FIRST is a static buffer in quote(). */
+		copy = strdup(xquote(strip_path(first), "\n\r"));
+		if (!copy) {
+			perror(progname);
+			exit(1);
+		}
+		output_line("# file: ", xquote(strip_path(path), "\n\r"),
+			    NULL);
+		output_line("# hard link to: ", copy, NULL);
+		output_line("", NULL, NULL);
+		free(copy);
+	}
+	xoutput(output_record_end(&output));
+}
+
+static void add_link(const char *path, const struct stat *stat, int printed)
+{
+	/* Once the set is full, later links are read again. */
+	inode_set_add(links, stat->st_dev, stat->st_ino, path, printed);
+}
+
 int do_print(const char *path, const struct stat *stat, int walk_flags,
 	     void *unused)
 {
-	int header_printed = 0;
+	int header_printed = 0, fd = -1, can_open;
 
 	if (walk_flags & WALK_TREE_FAILED) {
 		fprintf(stderr, "%s: %s: %s\n", progname, xquote(path, "\n\r"),
@@ -358,16 +805,803 @@ int do_print(const char *path, const struct stat *stat, int walk_flags,
 		return 1;
 	}
 
+	if (is_link(stat)) {
+		int printed;
+		const char *first = inode_set_find(links, stat->st_dev,
+						   stat->st_ino, &printed);
+
+		if (first) {
+			print_link(path, first, printed);
+			return 0;
+		}
+	}
+
+	/*
+	 * Open regular files and directories once instead of resolving the
+	 * path for each system call. Symlinks, special files and files we
+	 * cannot open are accessed by path.
+	 */
+	can_open = !(walk_flags & WALK_TREE_SYMLINK) &&
+		   (S_ISREG(stat->st_mode) || S_ISDIR(stat->st_mode));
+
+	if (num_queries || opt_value_size >= 0) {
+		int ret = query_match(path, can_open ? &fd : NULL);
+
+		if (ret <= 0 || !opt_dump) {
+			/* Without -d or -n, print the names of matches. */
+			if (ret > 0) {
+				print_match(path);
+				xoutput(output_record_end(&output));
+			}
+			if (fd >= 0)
+				close(fd);
+			if (ret >= 0 && is_link(stat))
+				add_link(path, stat, ret > 0);
+			return ret < 0;
+		}
+	}
+
+	if (fd < 0 && can_open)
+		fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+
 	if (opt_name)
-		print_attribute(path, opt_name, &header_printed);
+		print_attribute(path, fd, opt_name, &header_printed);
 	else
-		list_attributes(path, &header_printed);
+		list_attributes(path, fd, &header_printed);
+
+	if (fd >= 0)
+		close(fd);
 
 	if (header_printed)
-		puts("");
+		output_line("", NULL, NULL);
+	xoutput(output_record_end(&output));
+	if (is_link(stat))
+		add_link(path, stat, header_printed);
 	return 0;
 }
 
+/*
+ * The heaviest subtrees are those with the most bytes, or with the most
+ * files not fitting into their inodes.
+ */
+static unsigned long long usage_weight(const struct usage *usage)
+{
+	if (opt_fit)
+		return usage->overflows;
+	return usage->name_bytes + usage->value_bytes;
+}
+
+static void add_usage(struct usage *usage, const struct usage *more)
+{
+	usage->attrs += more->attrs;
+	usage->name_bytes += more->name_bytes;
+	usage->value_bytes += more->value_bytes;
+	usage->overflows += more->overflows;
+	usage->footprint += more->footprint;
+}
+
+static void output_usage(const struct usage *usage, const char *what)
+{
+	char buffer[3 * 24];
+
+	if (opt_fit)
+		snprintf(buffer, sizeof(buffer), "%llu\t%llu\t",
+			 usage->overflows, usage->footprint);
+	else
+		snprintf(buffer, sizeof(buffer), "%llu\t%llu\t%llu\t",
+			 usage->attrs, usage->name_bytes, usage->value_bytes);
+	output_line(buffer, what, NULL);
+}
+
+static void output_name_usage(const struct name_usage *name_usage)
+{
+	const struct usage *usage = &name_usage->usage;
+	char buffer[3 * 24];
+
+	if (opt_sample < 1)
+		snprintf(buffer, sizeof(buffer), "%.0f\t%.0f\t%.0f\t",
+			 name_usage->weighted[0], name_usage->weighted[1],
+			 name_usage->weighted[2]);
+	else if (opt_fit)
+		snprintf(buffer, sizeof(buffer), "%llu\t%llu\t%llu\t",
+			 usage->attrs, usage->overflows, usage->decisive);
+	else
+		snprintf(buffer, sizeof(buffer), "%llu\t%llu\t%llu\t",
+			 usage->attrs, usage->name_bytes, usage->value_bytes);
+	output_line(buffer, xquote(name_usage->name, "\n\r"), NULL);
+}
+
+static struct name_usage *name_usage_slot(const char *name)
+{
+	size_t mask = name_usages_size - 1, h;
+	const char *c;
+
+	for (h = 0, c = name; *c; c++)
+		h = h * 31 + (unsigned char)*c;
+	for (h &= mask; name_usages[h].name; h = (h + 1) & mask)
+		if (strcmp(name_usages[h].name, name) == 0)
+			break;
+	return &name_usages[h];
+}
+
+static struct name_usage *find_name_usage(const char *name)
+{
+	struct name_usage *slot;
+
+	if (2 * (num_name_usages + 1) > name_usages_size) {
+		struct name_usage *old = name_usages;
+		size_t old_size = name_usages_size, n;
+
+		name_usages_size = old_size ? 2 * old_size : 64;
+		name_usages = calloc(name_usages_size, sizeof(*name_usages));
+		if (!name_usages)
+			return NULL;
+		for (n = 0; n < old_size; n++)
+			if (old[n].name)
+				*name_usage_slot(old[n].name) = old[n];
+		free(old);
+	}
+	slot = name_usage_slot(name);
+	if (!slot->name) {
+		slot->name = strdup(name);
+		if (!slot->name)
+			return NULL;
+		num_name_usages++;
+	}
+	return slot;
+}
+
+/*
+ * Remember SUBTREE if it is one of the heaviest. Takes over its path.
+ */
+static void rank_subtree(struct subtree *subtree)
+{
+	int n;
+
+	if (num_heaviest == opt_summarize) {
+		if (usage_weight(&heaviest[num_heaviest - 1].usage) >=
+		    usage_weight(&subtree->usage)) {
+			free(subtree->path);
+			return;
+		}
+		free(heaviest[--num_heaviest].path);
+	}
+	for (n = num_heaviest; n > 0; n--) {
+		if (usage_weight(&heaviest[n - 1].usage) >=
+		    usage_weight(&subtree->usage))
+			break;
+		heaviest[n] = heaviest[n - 1];
+	}
+	heaviest[n] = *subtree;
+	num_heaviest++;
+}
+
+/*
+ * Add the estimate of a subtree visited with probability P to PARENT.
+ * If Y is the estimate of the subtree and V that of its variance, Y/P is
+ * unbiased for the subtree's contribution, and ((1-P) Y^2 + P V) / P^2
+ * for the variance of that.
+ */
+static void add_estimate(struct estimate *parent,
+			 const struct estimate *child, double p)
+{
+	int n;
+
+	for (n = 0; n < NUM_EST; n++) {
+		parent->total[n] += child->total[n] / p;
+		parent->var[n] += ((1 - p) * child->total[n] * child->total[n] +
+				   p * child->var[n]) / (p * p);
+	}
+}
+
+static void leave_subtree(void)
+{
+	struct subtree *subtree = &subtrees[--num_subtrees];
+
+	if (opt_sample < 1) {
+		struct estimate *estimate = &subtree->estimate;
+
+		if (num_subtrees)
+			add_estimate(&subtrees[num_subtrees - 1].estimate,
+				     estimate, opt_sample);
+		else
+			add_estimate(&sample_estimate, estimate, 1);
+		/* Report the estimate instead of what was visited. */
+		subtree->usage.attrs = estimate->total[EST_ATTRS] + 0.5;
+		subtree->usage.name_bytes =
+			estimate->total[EST_NAME_BYTES] + 0.5;
+		subtree->usage.value_bytes =
+			estimate->total[EST_VALUE_BYTES] + 0.5;
+	}
+	if (!usage_weight(&subtree->usage)) {
+		free(subtree->path);
+		return;
+	}
+	if (num_subtrees)
+		add_usage(&subtrees[num_subtrees - 1].usage, &subtree->usage);
+	output_usage(&subtree->usage, xquote(subtree->path, "\n\r"));
+	rank_subtree(subtree);
+}
+
+static int in_subtree(const struct subtree *subtree, const char *path)
+{
+	return strncmp(path, subtree->path, subtree->len) == 0 &&
+	       path[subtree->len] == '/';
+}
+
+static int parse_shard(const char *arg)
+{
+	unsigned long index, count, depth = 0;
+	char *end;
+
+	if (!isdigit(*arg))
+		return -1;
+	index = strtoul(arg, &end, 10);
+	if (*end++ != '/' || !isdigit(*end))
+		return -1;
+	count = strtoul(end, &end, 10);
+	if (*end == ':') {
+		if (!isdigit(*++end))
+			return -1;
+		depth = strtoul(end, &end, 10);
+	}
+	if (*end || count < 1 || index >= count || count > UINT_MAX ||
+	    depth > UINT_MAX)
+		return -1;
+	walk_tree_shard(index, count, depth);
+	return 0;
+}
+
+static int parse_skip_fs(char *arg)
+{
+	char *type;
+
+	for (type = strtok(arg, ","); type; type = strtok(NULL, ",")) {
+		if (strcmp(type, "pseudo") == 0)
+			walk_flags |= WALK_TREE_SKIP_PSEUDO;
+		else if (strcmp(type, "no-xattr") == 0)
+			walk_flags |= WALK_TREE_SKIP_NO_XATTR;
+		else
+			return -1;
+	}
+	return 0;
+}
+
+static int parse_fit(const char *arg)
+{
+	char *end;
+
+	if (strncmp(arg, "ext4", 4) == 0) {
+		fit_type = FIT_EXT4;
+		arg += 4;
+	} else if (strncmp(arg, "xfs", 3) == 0) {
+		fit_type = FIT_XFS;
+		arg += 3;
+	}
+	if (fit_type) {
+		if (*arg == '\0')
+			return 0;
+		if (*arg++ != ':')
+			return -1;
+	}
+	if (!isdigit(*arg))
+		return -1;
+	fit_inode_size = strtol(arg, &end, 10);
+	return (*end || fit_inode_size < 128) ? -1 : 0;
+}
+
+/*
+ * The layout of the filesystem PATH is on, or 0 if it is not known.
+ */
+static int fit_detect(const char *path, int fd, const struct stat *stat)
+{
+	static dev_t dev;
+	static int type = -1;
+	struct statfs buf;
+
+	if (fit_type)
+		return fit_type;
+	if (type >= 0 && stat->st_dev == dev)
+		return type;
+	dev = stat->st_dev;
+	type = 0;
+	if ((fd >= 0 ? fstatfs(fd, &buf) : statfs(path, &buf)) == 0) {
+		if (buf.f_type == EXT4_SUPER_MAGIC)
+			type = FIT_EXT4;
+		else if (buf.f_type == XFS_SUPER_MAGIC)
+			type = FIT_XFS;
+	}
+	return type;
+}
+
+/*
+ * Space for attributes in the inode. On ext4, this is what remains after
+ * the 128-byte base inode, the default 32 bytes of extra fields, and the
+ * 4-byte attribute header. On XFS, the attribute fork shares the literal
+ * area after the 176-byte v5 inode core with the data fork, which needs
+ * at least one 16-byte extent record; the fork offset is a multiple of 8.
+ */
+static unsigned long long fit_space(int type)
+{
+	int inode_size = fit_inode_size;
+
+	if (type == FIT_EXT4) {
+		if (!inode_size)
+			inode_size = 256;
+		return inode_size > 128 + 32 + 4 ? inode_size - 128 - 32 - 4 : 0;
+	}
+	if (!inode_size)
+		inode_size = 512;
+	return inode_size > 176 + 16 ? (inode_size - 176 - 16) & ~7 : 0;
+}
+
+/*
+ * Length of NAME on disk: the namespace prefix is stored as an index
+ * (ext4) or flag (XFS). XFS stores POSIX ACLs as SGI_ACL_FILE and
+ * SGI_ACL_DEFAULT.
+ */
+static size_t fit_name_len(int type, const char *name)
+{
+	static const char *prefixes[] = { "user.", "trusted.", "security." };
+	int n;
+
+	if (strcmp(name, "system.posix_acl_access") == 0)
+		return type == FIT_XFS ? 12 : 0;
+	if (strcmp(name, "system.posix_acl_default") == 0)
+		return type == FIT_XFS ? 15 : 0;
+	for (n = 0; n < sizeof(prefixes) / sizeof(*prefixes); n++)
+		if (strncmp(name, prefixes[n], strlen(prefixes[n])) == 0)
+			return strlen(name) - strlen(prefixes[n]);
+	if (type == FIT_EXT4 && strncmp(name, "system.", 7) == 0)
+		return strlen(name) - 7;
+	return strlen(name);
+}
+
+/*
+ * Estimated space the attributes take up in the inode, leaving out
+ * attribute SKIP. ext4 entries have a 16-byte header, and names and
+ * values are padded to 4 bytes; the list ends with a 4-byte null entry.
+ * XFS short form entries have a 3-byte header and no padding after a
+ * 4-byte header, and can only hold names and values shorter than 256
+ * bytes; *TOO_LARGE is set when an attribute cannot be stored inline at
+ * all.
+ */
+static unsigned long long fit_footprint(int type, const struct attr_size *attrs,
+					size_t num_attrs, size_t skip,
+					int *too_large)
+{
+	unsigned long long footprint = 4;
+	size_t n;
+
+	*too_large = 0;
+
+	for (n = 0; n < num_attrs; n++) {
+		size_t len = fit_name_len(type, attrs[n].name);
+
+		if (n == skip)
+			continue;
+		if (type == FIT_EXT4)
+			footprint += ((16 + len + 3) & ~3) +
+				     ((attrs[n].size + 3) & ~3);
+		else {
+			if (len > 255 || attrs[n].size > 255)
+				*too_large = 1;
+			footprint += 3 + len + attrs[n].size;
+		}
+	}
+	return footprint;
+}
+
+int do_summarize(const char *path, const struct stat *stat, int walk_flags,
+		 void *unused)
+{
+	static struct attr_size *attrs;
+	static size_t attrs_size;
+	struct usage usage;
+	struct subtree *subtree;
+	int fd = -1, type = 0, is_subtree = 0;
+	unsigned long long space = 0;
+	double weight;
+	size_t num_attrs = 0, n;
+	ssize_t length;
+	char *list, *l;
+
+	if (walk_flags & WALK_TREE_FAILED) {
+		fprintf(stderr, "%s: %s: %s\n", progname, xquote(path, "\n\r"),
+			strerror(errno));
+		return 1;
+	}
+
+	while (num_subtrees && !in_subtree(&subtrees[num_subtrees - 1], path))
+		leave_subtree();
+	if (num_subtrees && is_link(stat)) {
+		/* Count each inode once. */
+		if (inode_set_find(links, stat->st_dev, stat->st_ino, NULL))
+			return 0;
+		add_link(path, stat, 0);
+	}
+	if (!num_subtrees || S_ISDIR(stat->st_mode)) {
+		if (high_water_alloc((void **)&subtrees, &subtrees_size,
+				     (num_subtrees + 1) * sizeof(*subtrees)))
+			goto nomem;
+		subtree = &subtrees[num_subtrees];
+		subtree->path = strdup(path);
+		if (!subtree->path)
+			goto nomem;
+		subtree->len = strlen(path);
+		memset(&subtree->usage, 0, sizeof(subtree->usage));
+		memset(&subtree->estimate, 0, sizeof(subtree->estimate));
+		subtree->weight = num_subtrees ?
+			subtrees[num_subtrees - 1].weight / opt_sample : 1;
+		num_subtrees++;
+		is_subtree = 1;
+	}
+
+	if (!(walk_flags & WALK_TREE_SYMLINK) &&
+	    (S_ISREG(stat->st_mode) || S_ISDIR(stat->st_mode)))
+		fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+	if (opt_fit)
+		type = fit_detect(path, fd, stat);
+	length = read_names(path, fd, &list);
+	for (l = list; length > 0 && l < list + length; l += strlen(l) + 1) {
+		int matched = name_match(&name_matcher, l, strlen(l));
+		ssize_t size;
+
+		/* All attributes count towards the footprint. */
+		if (!matched && !type)
+			continue;
+		/* Only the size of the value is needed. */
+		size = do_getxattr(path, fd, l, NULL, 0);
+		if (size < 0)
+			continue;
+		if (high_water_alloc((void **)&attrs, &attrs_size,
+				     (num_attrs + 1) * sizeof(*attrs)))
+			goto nomem;
+		attrs[num_attrs].name = l;
+		attrs[num_attrs].size = size;
+		attrs[num_attrs].matched = matched;
+		num_attrs++;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	memset(&usage, 0, sizeof(usage));
+	if (type) {
+		unsigned long long footprint;
+		int too_large;
+
+		space = fit_space(type);
+		footprint = fit_footprint(type, attrs, num_attrs, num_attrs,
+					  &too_large);
+		if (footprint > space || too_large) {
+			usage.overflows = 1;
+			usage.footprint = footprint;
+		}
+	}
+	weight = subtrees[num_subtrees - 1].weight;
+	if (!is_subtree)
+		weight /= opt_sample;
+	for (n = 0; n < num_attrs; n++) {
+		struct name_usage *name_usage;
+		size_t len = strlen(attrs[n].name);
+
+		if (!attrs[n].matched)
+			continue;
+		name_usage = find_name_usage(attrs[n].name);
+		if (!name_usage)
+			goto nomem;
+		name_usage->usage.attrs++;
+		name_usage->usage.name_bytes += len;
+		name_usage->usage.value_bytes += attrs[n].size;
+		name_usage->weighted[0] += weight;
+		name_usage->weighted[1] += weight * len;
+		name_usage->weighted[2] += weight * attrs[n].size;
+		if (usage.overflows) {
+			int too_large;
+
+			name_usage->usage.overflows++;
+			if (fit_footprint(type, attrs, num_attrs, n,
+					  &too_large) <= space && !too_large)
+				name_usage->usage.decisive++;
+		}
+		usage.attrs++;
+		usage.name_bytes += len;
+		usage.value_bytes += attrs[n].size;
+	}
+	if (usage.overflows && !is_subtree)
+		output_usage(&usage, xquote(path, "\n\r"));
+	add_usage(&subtrees[num_subtrees - 1].usage, &usage);
+	if (opt_sample < 1) {
+		struct estimate own;
+
+		memset(&own, 0, sizeof(own));
+		own.total[EST_FILES] = 1;
+		own.total[EST_TAGGED] = usage.attrs != 0;
+		own.total[EST_ATTRS] = usage.attrs;
+		own.total[EST_NAME_BYTES] = usage.name_bytes;
+		own.total[EST_VALUE_BYTES] = usage.value_bytes;
+		/* A subtree is certain to contain itself. */
+		add_estimate(&subtrees[num_subtrees - 1].estimate, &own,
+			     is_subtree ? 1 : opt_sample);
+	}
+	return length < 0;
+
+nomem:
+	perror(progname);
+	exit(1);
+}
+
+static int compare_name_usages(const void *a, const void *b)
+{
+	const struct usage *ua = &((const struct name_usage *)a)->usage,
+			   *ub = &((const struct name_usage *)b)->usage;
+
+	if (opt_sample < 1) {
+		const double *wa = ((const struct name_usage *)a)->weighted,
+			     *wb = ((const struct name_usage *)b)->weighted;
+
+		if (wa[1] + wa[2] != wb[1] + wb[2])
+			return wa[1] + wa[2] > wb[1] + wb[2] ? -1 : 1;
+	} else if (opt_fit) {
+		if (ua->decisive != ub->decisive)
+			return ua->decisive > ub->decisive ? -1 : 1;
+		if (ua->overflows != ub->overflows)
+			return ua->overflows > ub->overflows ? -1 : 1;
+	} else if (ua->name_bytes + ua->value_bytes !=
+		   ub->name_bytes + ub->value_bytes)
+		return ua->name_bytes + ua->value_bytes >
+		       ub->name_bytes + ub->value_bytes ? -1 : 1;
+	return strcmp(((const struct name_usage *)a)->name,
+		      ((const struct name_usage *)b)->name);
+}
+
+/*
+ * Finish the subtrees still open, and print the per-name totals and the
+ * heaviest subtrees.
+ */
+void print_summary(void)
+{
+	char buffer[24];
+	size_t n, m;
+	int h;
+
+	while (num_subtrees)
+		leave_subtree();
+
+	for (n = 0, m = 0; n < name_usages_size; n++)
+		if (name_usages[n].name)
+			name_usages[m++] = name_usages[n];
+	qsort(name_usages, m, sizeof(*name_usages), compare_name_usages);
+	output_line("", NULL, NULL);
+	if (opt_fit)
+		output_line(_("# names: files, files not fitting, files which "
+			      "would fit without"), NULL, NULL);
+	else
+		output_line(_("# names: attributes, name bytes, value bytes"),
+			    NULL, NULL);
+	for (n = 0; n < m; n++)
+		output_name_usage(&name_usages[n]);
+
+	output_line("", NULL, NULL);
+	if (opt_fit)
+		output_line(_("# subtrees with most files not fitting"),
+			    NULL, NULL);
+	else
+		output_line(_("# heaviest subtrees: bytes"), NULL, NULL);
+	for (h = 0; h < num_heaviest; h++) {
+		snprintf(buffer, sizeof(buffer), "%llu\t",
+			 usage_weight(&heaviest[h].usage));
+		output_line(buffer, xquote(heaviest[h].path, "\n\r"), NULL);
+	}
+
+	if (opt_sample < 1) {
+		const char *what[NUM_EST] = {
+			[EST_FILES] = _("files"),
+			[EST_TAGGED] = _("files with attributes"),
+			[EST_ATTRS] = _("attributes"),
+			[EST_NAME_BYTES] = _("name bytes"),
+			[EST_VALUE_BYTES] = _("value bytes"),
+		};
+		char line[128];
+		int e;
+
+		output_line("", NULL, NULL);
+		snprintf(line, sizeof(line), _("# estimated totals, 95%% "
+			 "confidence (rate %g, seed %llu)"), opt_sample,
+			 opt_seed);
+		output_line(line, NULL, NULL);
+		for (e = 0; e < NUM_EST; e++) {
+			snprintf(line, sizeof(line), "%.0f\t%.0f\t",
+				 sample_estimate.total[e],
+				 1.96 * sqrt(sample_estimate.var[e]));
+			output_line(line, what[e], NULL);
+		}
+	}
+}
+
+/*
+ * Walk each path listed in FILENAME, one per line, or terminated by '\0'
+ * with -0. Empty lines are skipped.
+ */
+int walk_files_from(const char *filename)
+{
+	struct input in;
+	char *path = NULL;
+	size_t size = 0;
+	int ret, errors = 0;
+
+	if (input_open(&in, filename, opt_null ? INPUT_NUL : 0) != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, filename,
+			strerror(errno));
+		return 1;
+	}
+	while ((ret = input_next_name(&in, &path, &size)) > 0)
+		errors += walk_tree(path, walk_flags, 0,
+				    opt_summarize ? do_summarize : do_print,
+				    NULL);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, filename,
+			strerror(errno));
+		errors++;
+	}
+	input_close(&in);
+	free(path);
+	return errors;
+}
+
+/*
+ * Merging the output of --shard runs. A record is either the lines from
+ * "# file:" up to the next empty line, or a single line naming a file.
+ */
+struct merge_input {
+	const char *filename;
+	struct input in;
+	char *record;
+	size_t record_size, len;
+	char *key;  /* the unquoted path name of the record */
+	size_t key_size;
+};
+
+static int append_record(struct merge_input *m, const char *line, size_t len,
+			 char delim)
+{
+	if (high_water_alloc((void **)&m->record, &m->record_size,
+			     m->len + len + 1))
+		return -1;
+	memcpy(m->record + m->len, line, len);
+	m->record[m->len + len] = delim;
+	m->len += len + 1;
+	return 0;
+}
+
+/* Remember the path name of the record; QUOTED if it was quoted. */
+static int set_key(struct merge_input *m, const char *path, size_t len,
+		   int quoted)
+{
+	if (high_water_alloc((void **)&m->key, &m->key_size, len + 1))
+		return -1;
+	memcpy(m->key, path, len);
+	m->key[len] = '\0';
+	if (quoted)
+		unquote(m->key);
+	return 0;
+}
+
+/* Returns 1 for a record, 0 at the end of the input, and -1 on errors. */
+static int read_record(struct merge_input *m)
+{
+	const char *line;
+	size_t len;
+	int ret;
+
+	m->len = 0;
+	while ((ret = input_next_line(&m->in, &line, &len)) > 0) {
+		if (m->len) {
+			if (append_record(m, line, len, '\n'))
+				return -1;
+			if (len == 0)
+				return 1;
+		} else if (len >= 8 && memcmp(line, "# file: ", 8) == 0) {
+			if (set_key(m, line + 8, len - 8, 1) ||
+			    append_record(m, line, len, '\n'))
+				return -1;
+		} else if (len) {
+			/* With -0, the names of matching files are unquoted. */
+			if (set_key(m, line, len, !opt_null) ||
+			    append_record(m, line, len, opt_null ? '\0' : '\n'))
+				return -1;
+			return 1;
+		}
+	}
+	if (ret == 0 && m->len)
+		return append_record(m, "", 0, '\n') ? -1 : 1;
+	return ret;
+}
+
+/*
+ * Order path names like the walk of --shard: a directory comes before the
+ * entries in it, and entries are sorted by name.
+ */
+static int compare_keys(const struct merge_input *a,
+			const struct merge_input *b)
+{
+	const unsigned char *p = (unsigned char *)a->key,
+			    *q = (unsigned char *)b->key;
+
+	while (*p && *p == *q)
+		p++, q++;
+	if (*p == *q)
+		return 0;
+	if (!*p)
+		return -1;
+	if (!*q)
+		return 1;
+	if (*p == '/')
+		return -1;
+	if (*q == '/')
+		return 1;
+	return *p < *q ? -1 : 1;
+}
+
+static int merge_error(struct merge_input *m)
+{
+	fprintf(stderr, "%s: %s: %s\n", progname, m->filename,
+		strerror(errno));
+	return 1;
+}
+
+int merge(char *filenames[], int num)
+{
+	struct merge_input *inputs, *next;
+	int n, ret, errors = 0, active = 0;
+
+	inputs = calloc(num, sizeof(*inputs));
+	if (!inputs) {
+		perror(progname);
+		return 1;
+	}
+	for (n = 0; n < num; n++) {
+		struct merge_input *m = &inputs[n];
+
+		m->filename = filenames[n];
+		if (input_open(&m->in, m->filename,
+			       opt_null ? INPUT_NUL : 0) != 0) {
+			errors += merge_error(m);
+			continue;
+		}
+		ret = read_record(m);
+		if (ret < 0)
+			errors += merge_error(m);
+		if (ret <= 0) {
+			input_close(&m->in);
+			free(m->record);
+			free(m->key);
+			continue;
+		}
+		inputs[active++] = *m;
+	}
+
+	while (active) {
+		next = &inputs[0];
+		for (n = 1; n < active; n++)
+			if (compare_keys(&inputs[n], next) < 0)
+				next = &inputs[n];
+		xoutput(output_write(&output, next->record, next->len));
+		xoutput(output_record_end(&output));
+		ret = read_record(next);
+		if (ret < 0)
+			errors += merge_error(next);
+		if (ret <= 0) {
+			input_close(&next->in);
+			free(next->record);
+			free(next->key);
+			*next = inputs[--active];
+		}
+	}
+	free(inputs);
+	return errors;
+}
+
 void help(void)
 {
 	printf(_("%s %s -- get extended attributes\n"),
@@ -380,7 +1614,35 @@ void help(void)
 "  -e, --encoding=...      encode values (as 'text', 'hex' or 'base64')\n"
 "      --match=pattern     only get attributes with names matching pattern\n"
 "      --only-values       print the bare values only\n"
+"      --output=file       write the output to file\n"
+"      --files-from=file   read path names from file, one per line\n"
+"  -0, --null              path names in file and output are terminated\n"
+"                          by NUL\n"
+"      --has=name          only files which have attribute name\n"
+"      --where=name==value only files where the value of name equals value\n"
+"                          (also name!=value, and name*=value: contains)\n"
+"      --value-size=[+-]n  only files with a value of more than (+), less\n"
+"                          than (-) or exactly n bytes (see --match)\n"
+"      --summarize[=n]     add up attributes per directory and name, and\n"
+"                          list the n heaviest subtrees (default 10)\n"
+"      --sample=rate       like --summarize, but only visit a fraction rate\n"
+"                          of each directory and estimate the totals\n"
+"      --seed=n            random seed for --sample\n"
+"      --inline-fit[=[fs:]inode-size]\n"
+"                          summarize files whose attributes do not fit into\n"
+"                          the inode (fs: ext4 or xfs, detected by default)\n"
 "  -h, --no-dereference    do not dereference symbolic links\n"
+"      --hardlinks         read files with several links only once\n"
+"      --shard=i/n[:depth] only visit the entries of shard i of n (see the\n"
+"                          manual page)\n"
+"      --merge             merge the output of --shard runs in files\n"
+"      --max-ops-per-sec=n limit system calls to n per second\n"
+"      --max-bytes-per-sec=n\n"
+"                          limit attribute data read to n bytes per second\n"
+"                          (n may end in k, M or G)\n"
+"      --idle              run with idle I/O and CPU priority\n"
+"      --skip-fs=type,...  do not descend into pseudo filesystems (pseudo)\n"
+"                          or filesystems without attributes (no-xattr)\n"
 "      --absolute-names    don't strip leading '/' in pathnames\n"
 "  -R, --recursive         recurse into subdirectories\n"
 "  -L, --logical           logical walk, follow symbolic links\n"
@@ -438,6 +1700,126 @@ int main(int argc, char *argv[])
 					opt_name_pattern = "";
 				break;
 
+			case 'O':  /* output file */
+				opt_output = optarg;
+				break;
+
+			case 'F':  /* read path names from file */
+				opt_files_from = optarg;
+				break;
+
+			case '0':  /* NUL terminated path names */
+				opt_null = 1;
+				break;
+
+			case 'A':  /* only files which have attribute */
+				if (add_query(QUERY_HAS, optarg) != 0)
+					goto query_error;
+				break;
+
+			case 'W':  /* only files where value compares */
+				if (add_query(QUERY_EQUAL, optarg) != 0)
+					goto query_error;
+				break;
+
+			case 'Z': {  /* only files with value of size */
+				char *end;
+
+				if (*optarg == '+' || *optarg == '-')
+					opt_value_size_cmp = *optarg++;
+				if (!isdigit(*optarg))
+					goto synopsis;
+				opt_value_size = strtoll(optarg, &end, 10);
+				if (*end)
+					goto synopsis;
+				break;
+			}
+
+			case 'S': {  /* summarize */
+				char *end;
+
+				opt_summarize = 10;
+				if (!optarg)
+					break;
+				if (!isdigit(*optarg))
+					goto synopsis;
+				opt_summarize = strtol(optarg, &end, 10);
+				if (*end || opt_summarize < 1)
+					goto synopsis;
+				break;
+			}
+
+			case 'r': {  /* sample */
+				char *end;
+
+				opt_sample = strtod(optarg, &end);
+				if (*end || !(opt_sample > 0 && opt_sample <= 1))
+					goto synopsis;
+				if (!opt_summarize)
+					opt_summarize = 10;
+				break;
+			}
+
+			case 'D': {  /* random seed for sampling */
+				char *end;
+
+				if (!isdigit(*optarg))
+					goto synopsis;
+				opt_seed = strtoull(optarg, &end, 10);
+				if (*end)
+					goto synopsis;
+				have_seed = 1;
+				break;
+			}
+
+			case 'l':  /* read hard links only once */
+				links = inode_set_create(LINKS_MAX_BYTES);
+				if (!links) {
+					perror(progname);
+					return 1;
+				}
+				break;
+
+			case 'T':  /* shard */
+				if (parse_shard(optarg) != 0)
+					goto synopsis;
+				break;
+
+			case 'M':  /* merge shards */
+				opt_merge = 1;
+				break;
+
+			case 'o':  /* operations per second */
+				if (rate_limit_parse(optarg, &opt_max_ops) != 0)
+					goto synopsis;
+				break;
+
+			case 'b':  /* bytes per second */
+				if (rate_limit_parse(optarg,
+						     &opt_max_bytes) != 0)
+					goto synopsis;
+				break;
+
+			case 'i':  /* background priority */
+				if (rate_limit_idle() != 0) {
+					perror(progname);
+					return 1;
+				}
+				break;
+
+			case 'K':  /* filesystems not to descend into */
+				if (parse_skip_fs(optarg) != 0)
+					goto synopsis;
+				break;
+
+			case 'I':  /* estimate if attributes fit into the inode */
+				opt_fit = 1;
+				if (!opt_summarize)
+					opt_summarize = 10;
+				if (optarg && parse_fit(optarg) != 0)
+					goto synopsis;
+				break;
+
 			case 'v':  /* get attribute values only */
 				opt_value_only = 1;
 				break;
@@ -466,24 +1848,69 @@ int main(int argc, char *argv[])
 				goto synopsis;
 		}
 	}
-	if (optind >= argc)
+	if (optind >= argc && !opt_files_from)
+		goto synopsis;
+	if (opt_fit && opt_sample < 1)
 		goto synopsis;
 
-	if (regcomp(&name_regex, opt_name_pattern,
-	            REG_EXTENDED | REG_NOSUB) != 0) {
+	rate_limit_set(opt_max_ops, opt_max_bytes);
+
+	if (opt_sample < 1) {
+		if (!have_seed)
+			opt_seed = time(NULL) ^ ((unsigned long long)getpid() << 32);
+		walk_tree_sample(opt_sample, opt_seed);
+	}
+
+	if (name_match_compile(&name_matcher, opt_name_pattern) != 0) {
 		fprintf(stderr, _("%s: invalid regular expression \"%s\"\n"),
 			progname, opt_name_pattern);
 		return 1;
 	}
 
+	if (output_open(&output, opt_output) != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, opt_output,
+			strerror(errno));
+		return 1;
+	}
+
+	if (opt_merge) {
+		had_errors = merge(argv + optind, argc - optind);
+		xoutput(output_close(&output));
+		return (had_errors ? 1 : 0);
+	}
+
+	if (opt_summarize) {
+		heaviest = malloc(opt_summarize * sizeof(*heaviest));
+		if (!heaviest) {
+			perror(progname);
+			return 1;
+		}
+		if (opt_fit)
+			output_line(_("# files not fitting: count, footprint "
+				      "bytes"), NULL, NULL);
+		else
+			output_line(_("# directories: attributes, name bytes, "
+				      "value bytes"), NULL, NULL);
+	}
+
 	while (optind < argc) {
 		had_errors += walk_tree(argv[optind], walk_flags, 0,
-					do_print, NULL);
+					opt_summarize ? do_summarize : do_print,
+					NULL);
 		optind++;
 	}
+	if (opt_files_from)
+		had_errors += walk_files_from(opt_files_from);
+	if (opt_summarize)
+		print_summary();
+	xoutput(output_close(&output));
 
 	return (had_errors ? 1 : 0);
 
+query_error:
+	fprintf(stderr, "%s: %s: %s\n", progname, optarg, strerror(errno));
+	return 2;
+
 synopsis:
 	fprintf(stderr, _("Usage: %s %s\n"
 	                  "Try `%s --help' for more information.\n"),
@@ -0,0 +1,113 @@
+/*
+  File: attrd.h
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __ATTRD_H__
+#define __ATTRD_H__
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Protocol of the attrd daemon. Clients connect to a Unix domain stream
+ * socket and send requests, each carrying a batch of operations; for each
+ * request, the daemon sends one response with a result per operation, in
+ * the same order. All integers are in host byte order, and there is no
+ * padding.
+ *
+ * Request:	u32 size		(of the rest of the request)
+ *		u32 num_ops
+ *		num_ops times:
+ *		  u8 op, u8 flags, u16 name_len, u32 path_len, u32 value_len
+ *		  path, name, value	(not '\0'-terminated)
+ *
+ * Response:	u32 size		(of the rest of the response)
+ *		u32 num_results
+ *		num_results times:
+ *		  s32 error		(0, or an errno value)
+ *		  u32 len
+ *		  data			(the value for ATTRD_GET, the
+ *					 '\0'-separated names for ATTRD_LIST)
+ *
+ * ATTRD_LIST and ATTRD_COPY have no name. ATTRD_COPY copies the attributes
+ * of path to the file given as its value, like attr_copy_file().
+ *
+ * Neither requests nor responses exceed ATTRD_MAX_MESSAGE bytes: results
+ * which do not fit into the response fail with E2BIG.
+ */
+
+#define ATTRD_GET		1
+#define ATTRD_SET		2
+#define ATTRD_LIST		3
+#define ATTRD_REMOVE		4
+#define ATTRD_COPY		5
+
+#define ATTRD_NOFOLLOW		0x01  /* do not follow a final symlink */
+#define ATTRD_CREATE		0x02  /* like XATTR_CREATE */
+#define ATTRD_REPLACE		0x04  /* like XATTR_REPLACE */
+
+#define ATTRD_MAX_MESSAGE	(64 << 20)
+
+#define ATTRD_SOCKET		"/run/attrd.sock"
+
+/*
+ * The socket used by default: $ATTRD_SOCKET if set, else attrd.sock in
+ * $XDG_RUNTIME_DIR if set, else ATTRD_SOCKET.
+ */
+extern const char *attrd_socket_path(void);
+
+/*
+ * Client library. Operations are collected in a batch and sent to the
+ * daemon with attrd_run(); afterwards, attrd_result() returns the result
+ * of each operation. A batch can be reused after attrd_batch_reset().
+ * When attrd_run() fails, the connection is closed, and later calls fail
+ * with ENOTCONN.
+ */
+
+struct attrd;
+struct attrd_batch;
+
+extern struct attrd *attrd_connect(const char *socket_path);
+extern void attrd_disconnect(struct attrd *attrd);
+
+extern struct attrd_batch *attrd_batch_new(void);
+extern void attrd_batch_reset(struct attrd_batch *batch);
+extern void attrd_batch_free(struct attrd_batch *batch);
+
+extern int attrd_get(struct attrd_batch *batch, const char *path,
+		     const char *name, int flags);
+extern int attrd_set(struct attrd_batch *batch, const char *path,
+		     const char *name, const void *value, size_t size,
+		     int flags);
+extern int attrd_list(struct attrd_batch *batch, const char *path,
+		      int flags);
+extern int attrd_remove(struct attrd_batch *batch, const char *path,
+			const char *name, int flags);
+extern int attrd_copy(struct attrd_batch *batch, const char *src_path,
+		      const char *dst_path, int flags);
+
+extern int attrd_run(struct attrd *attrd, struct attrd_batch *batch);
+extern int attrd_result(struct attrd_batch *batch, unsigned int n,
+			const void **data, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -123,6 +123,9 @@ extern int attr_get (const char *__path, const char *__attrname,
 			char *__attrvalue, int *__valuelength, int __flags);
 extern int attr_getf (int __fd, const char *__attrname, char *__attrvalue,
 			int *__valuelength, int __flags);
+extern int attr_getat (int __dirfd, const char *__path,
+			const char *__attrname, char *__attrvalue,
+			int *__valuelength, int __flags);
 
 /*
  * Set the value of an attribute, creating the attribute if necessary.
@@ -134,6 +137,9 @@ extern int attr_set (const char *__path, const char *__attrname,
 extern int attr_setf (int __fd, const char *__attrname,
 			const char *__attrvalue, const int __valuelength,
 			int __flags);
+extern int attr_setat (int __dirfd, const char *__path,
+			const char *__attrname, const char *__attrvalue,
+			const int __valuelength, int __flags);
 
 /*
  * Remove an attribute.
@@ -142,6 +148,8 @@ extern int attr_setf (int __fd, const char *__attrname,
 extern int attr_remove (const char *__path, const char *__attrname,
 			int __flags);
 extern int attr_removef (int __fd, const char *__attrname, int __flags);
+extern int attr_removeat (int __dirfd, const char *__path,
+			const char *__attrname, int __flags);
 
 /*
  * List the names and sizes of the values of all the attributes of an object.
@@ -154,6 +162,9 @@ int attr_list(const char *__path, char *__buffer, const int __buffersize,
 		int __flags, attrlist_cursor_t *__cursor);
 int attr_listf(int __fd, char *__buffer, const int __buffersize,
 		int __flags, attrlist_cursor_t *__cursor);
+int attr_listat(int __dirfd, const char *__path, char *__buffer,
+		const int __buffersize, int __flags,
+		attrlist_cursor_t *__cursor);
 
 /*
  * Operate on multiple attributes of the same object simultaneously.
@@ -177,6 +188,13 @@ extern int attr_multi (const char *__path, attr_multiop_t *__oplist,
 extern int attr_multif (int __fd, attr_multiop_t *__oplist,
 			int __count, int __flags);
 
+/*
+ * The *at variants operate on __path relative to the directory file
+ * descriptor __dirfd (or AT_FDCWD). An empty __path refers to __dirfd itself.
+ */
+extern int attr_multiat (int __dirfd, const char *__path,
+			attr_multiop_t *__oplist, int __count, int __flags);
+
 #ifdef __cplusplus
 }
 #endif
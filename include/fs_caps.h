@@ -0,0 +1,40 @@
+/*
+  File: fs_caps.h
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __FS_CAPS_H
+#define __FS_CAPS_H
+
+#include <sys/types.h>
+
+/*
+ * What the filesystems, identified by device number, can do with
+ * extended attributes. A filesystem is classified from its statfs()
+ * f_type and a single listxattr() the first time it is seen; namespaces
+ * in which an operation failed with EOPNOTSUPP are remembered as well.
+ * What is known about a filesystem is forgotten after a minute. The cache
+ * is shared by all threads.
+ */
+
+#define FS_CAPS_PSEUDO		0x01  /* proc, sysfs, cgroup, ... */
+#define FS_CAPS_NO_XATTR	0x02  /* no extended attributes at all */
+
+extern int fs_caps(dev_t dev, const char *path);
+extern int fs_caps_unsupported(dev_t dev, const char *name);
+extern void fs_caps_set_unsupported(dev_t dev, const char *name);
+
+#endif
@@ -0,0 +1,39 @@
+/*
+  File: inode_set.h
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef __INODE_SET_H
+#define __INODE_SET_H
+
+#include <sys/types.h>
+
+/*
+ * A set of inodes, each remembered with the path under which it was
+ * first seen and a value of the caller's choosing. The set stops
+ * growing once it would use more than a given number of bytes.
+ */
+
+struct inode_set;
+
+extern struct inode_set *inode_set_create(size_t max_bytes);
+extern void inode_set_free(struct inode_set *set);
+extern const char *inode_set_find(struct inode_set *set, dev_t dev,
+				  ino_t ino, int *value);
+extern int inode_set_add(struct inode_set *set, dev_t dev, ino_t ino,
+			 const char *path, int value);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+  File: input.h
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __INPUT_H
+#define __INPUT_H
+
+#include <sys/types.h>
+
+/*
+ * Line oriented input directly on top of mmap(2) or read(2). Regular
+ * files are mapped and lines are returned as pointers into the mapping;
+ * pipes and other files are read in large chunks. Lines are not
+ * '\0'-terminated, and are only valid until the next call.
+ *
+ * Mapped input is seekable; other input can only be skipped forward.
+ * With INPUT_SPOOL, input which cannot be mapped is first copied into a
+ * temporary file, which is mapped instead.
+ */
+
+#define INPUT_MMAP		0x01  /* buf is a mapping of the file */
+#define INPUT_CLOSE		0x02  /* close fd in input_close() */
+#define INPUT_EOF		0x04  /* no more data in the file */
+#define INPUT_SPOOL		0x08  /* copy unmappable input to a temp file */
+#define INPUT_NUL		0x10  /* lines are terminated by '\0' */
+
+struct input {
+	int fd;
+	int flags;
+	char *buf;
+	size_t size;
+	size_t pos, end, scan;
+	off_t base;  /* file offset of buf */
+};
+
+extern int input_open(struct input *in, const char *filename, int flags);
+extern int input_next_line(struct input *in, const char **line, size_t *len);
+extern int input_next_name(struct input *in, char **buf, size_t *size);
+extern size_t input_buffered(const struct input *in);
+extern off_t input_tell(const struct input *in);
+extern int input_seek(struct input *in, off_t pos);
+extern int input_close(struct input *in);
+
+#endif
@@ -30,6 +30,9 @@ extern int attr_copy_file (const char *, const char *,
 extern int attr_copy_fd (const char *, int, const char *, int,
 			 int (*) (const char *, struct error_context *),
 			 struct error_context *);
+extern int attr_copy_fileat (int, const char *, int, const char *,
+			     int (*) (const char *, struct error_context *),
+			     struct error_context *);
 
 /* Keep this function for backwards compatibility. */
 extern int attr_copy_check_permissions(const char *, struct error_context *);
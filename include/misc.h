@@ -20,4 +20,4 @@ extern int high_water_alloc(void **buf, size_t *bufsize, size_t newsize);
 extern const char *quote(const char *str, const char *quote_chars);
 extern char *unquote(char *str);
 
-extern char *next_line(FILE *file);
+extern ssize_t decode_value(const char *value, size_t size, char *decoded);
@@ -0,0 +1,56 @@
+/*
+  File: name_match.h
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __NAME_MATCH_H
+#define __NAME_MATCH_H
+
+#include <sys/types.h>
+#include <regex.h>
+
+/*
+ * An extended regular expression for matching attribute names. Patterns
+ * which are alternations of plain strings (optionally anchored with ^
+ * and $) are matched with direct comparisons; everything else is left
+ * to regexec().
+ */
+
+#define NAME_MATCH_ALL		0
+#define NAME_MATCH_LITERAL	1
+#define NAME_MATCH_REGEX	2
+
+#define NAME_MATCH_ANCHOR_START	0x01
+#define NAME_MATCH_ANCHOR_END	0x02
+
+struct name_match_literal {
+	char *str;
+	size_t len;
+	int anchors;
+};
+
+struct name_match {
+	int type;
+	struct name_match_literal *literals;
+	size_t num_literals;
+	regex_t regex;
+};
+
+extern int name_match_compile(struct name_match *match, const char *pattern);
+extern int name_match(const struct name_match *match, const char *name,
+		      size_t len);
+extern void name_match_free(struct name_match *match);
+
+#endif
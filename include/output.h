@@ -0,0 +1,48 @@
+/*
+  File: output.h
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __OUTPUT_H
+#define __OUTPUT_H
+
+#include <sys/types.h>
+
+/*
+ * Buffered output directly on top of write(2)/writev(2). Small writes
+ * are collected in a page aligned buffer; large writes are passed to
+ * the kernel together with the buffered data without being copied.
+ */
+
+#define OUTPUT_TTY		0x01  /* flush after each record */
+#define OUTPUT_PREALLOC		0x02  /* preallocate space in the file */
+#define OUTPUT_CLOSE		0x04  /* close fd in output_close() */
+
+struct output {
+	int fd;
+	int flags;
+	char *buf;
+	size_t size, len;
+	off_t written, allocated;
+};
+
+extern int output_open(struct output *out, const char *filename);
+extern int output_write(struct output *out, const void *data, size_t len);
+extern int output_puts(struct output *out, const char *str);
+extern int output_record_end(struct output *out);
+extern int output_flush(struct output *out);
+extern int output_close(struct output *out);
+
+#endif
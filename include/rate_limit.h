@@ -0,0 +1,33 @@
+/*
+  File: rate_limit.h
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RATE_LIMIT_H
+#define __RATE_LIMIT_H
+
+#include <sys/types.h>
+
+/*
+ * Process-wide limits on the rate of filesystem operations and of the
+ * bytes they transfer, and background scheduling priority.
+ */
+
+extern void rate_limit_set(double ops_per_sec, double bytes_per_sec);
+extern void rate_limit(unsigned int ops, size_t bytes);
+extern int rate_limit_parse(const char *arg, double *rate);
+extern int rate_limit_idle(void);
+
+#endif
@@ -25,15 +25,22 @@
 #define WALK_TREE_LOGICAL		0x04
 #define WALK_TREE_DEREFERENCE		0x08
 #define WALK_TREE_DEREFERENCE_TOPLEVEL	0x10
+#define WALK_TREE_FS_CAPS		0x20
+#define WALK_TREE_SKIP_PSEUDO		0x40
+#define WALK_TREE_SKIP_NO_XATTR		0x80
 
 #define WALK_TREE_TOPLEVEL	0x100
 #define WALK_TREE_SYMLINK	0x200
 #define WALK_TREE_FAILED	0x400
+#define WALK_TREE_NO_XATTR	0x800
 
 struct stat;
 
 extern int walk_tree(const char *path, int walk_flags, unsigned int num,
 		     int (*func)(const char *, const struct stat *, int,
 				 void *), void *arg);
+extern void walk_tree_sample(double rate, unsigned long long seed);
+extern void walk_tree_shard(unsigned int index, unsigned int count,
+			    unsigned int depth);
 
 #endif
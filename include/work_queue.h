@@ -0,0 +1,51 @@
+/*
+  File: work_queue.h
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __WORK_QUEUE_H
+#define __WORK_QUEUE_H
+
+/*
+ * A fixed pool of worker threads which take items from a shared bounded
+ * queue. With WORK_QUEUE_KEYED, each worker has a bounded queue of its
+ * own instead, and items are assigned to workers by key: items with the
+ * same key are processed by the same worker, in the order in which they
+ * were added. work_queue_add() blocks while the queue is full.
+ *
+ * work_queue_adapt() turns the pool into an upper limit, and adjusts the
+ * number of items processed at the same time to the latency and
+ * throughput observed.
+ */
+
+#define WORK_QUEUE_AUTO_MAX	64  /* threads for "auto" */
+
+#define WORK_QUEUE_KEYED	0x01  /* keep the order of items by key */
+
+struct work_queue;
+
+extern struct work_queue *work_queue_create(unsigned int num_threads,
+					    unsigned int queue_size,
+					    int flags,
+					    void (*func)(void *, void *),
+					    void *arg);
+extern int work_queue_add(struct work_queue *wq, void *item,
+			  unsigned long key);
+extern int work_queue_adapt(struct work_queue *wq, unsigned int min_threads);
+extern int work_queue_parse_threads(const char *arg, unsigned int *min,
+				    unsigned int *max);
+extern void work_queue_finish(struct work_queue *wq);
+
+#endif
@@ -58,6 +58,24 @@ extern int removexattr (const char *__path, const char *__name) __THROW;
 extern int lremovexattr (const char *__path, const char *__name) __THROW;
 extern int fremovexattr (int __filedes,   const char *__name) __THROW;
 
+/*
+ * Variants relative to a directory file descriptor. __at_flags may contain
+ * AT_SYMLINK_NOFOLLOW and AT_EMPTY_PATH (see <fcntl.h>); an empty __path
+ * together with AT_EMPTY_PATH refers to __dirfd itself.
+ */
+extern int attr_setxattrat (int __dirfd, const char *__path,
+			    int __at_flags, const char *__name,
+			    const void *__value, size_t __size,
+			    int __flags) __THROW;
+extern ssize_t attr_getxattrat (int __dirfd, const char *__path,
+				int __at_flags, const char *__name,
+				void *__value, size_t __size) __THROW;
+extern ssize_t attr_listxattrat (int __dirfd, const char *__path,
+				 int __at_flags, char *__list,
+				 size_t __size) __THROW;
+extern int attr_removexattrat (int __dirfd, const char *__path,
+			       int __at_flags, const char *__name) __THROW;
+
 __END_DECLS
 
 #endif	/* __XATTR_H__ */
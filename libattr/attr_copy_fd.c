@@ -53,6 +53,24 @@
 # define my_free(ptr) free (ptr)
 #endif
 
+#if defined(HAVE_FLISTXATTR) && defined(HAVE_FGETXATTR) && \
+    defined(HAVE_FSETXATTR)
+/* A bit for the namespace of NAME. Once setting an attribute failed with
+   ENOTSUP, the destination does not support that namespace, and the
+   remaining attributes in it are not read. Whether security.* and
+   system.* attributes are supported depends on the name, so 0 is
+   returned for them. */
+static unsigned int
+name_namespace(const char *name)
+{
+	if (strncmp(name, "user.", 5) == 0)
+		return 1;
+	if (strncmp(name, "trusted.", 8) == 0)
+		return 2;
+	return 0;
+}
+#endif
+
 /* Copy extended attributes from src_path to dst_path. If the file
    has an extended Access ACL (system.posix_acl_access) and that is
    copied successfully, the file mode permission bits are copied as
@@ -70,6 +88,7 @@ attr_copy_fd(const char *src_path, int src_fd,
 	ssize_t size;
 	char *names = NULL, *end_names, *name, *value = NULL;
 	unsigned int setxattr_ENOTSUP = 0;
+	unsigned int unsupported = 0;  /* namespaces, see name_namespace() */
 
 	/* ignore acls by default */
 	if (check == NULL)
@@ -109,6 +128,10 @@ attr_copy_fd(const char *src_path, int src_fd,
 		/* check if this attribute shall be preserved */
 		if (!*name || !check(name, ctx))
 			continue;
+		if (unsupported & name_namespace(name)) {
+			setxattr_ENOTSUP++;
+			continue;
+		}
 
 		size = fgetxattr (src_fd, name, NULL, 0);
 		if (size < 0) {
@@ -139,9 +162,10 @@ attr_copy_fd(const char *src_path, int src_fd,
 			continue;
 		}
 		if (fsetxattr (dst_fd, name, value, size, 0) != 0) {
-			if (errno == ENOTSUP)
+			if (errno == ENOTSUP) {
 				setxattr_ENOTSUP++;
-			else {
+				unsupported |= name_namespace(name);
+			} else {
 				const char *qpath = quote (ctx, dst_path);
 
 				if (errno == ENOSYS) {
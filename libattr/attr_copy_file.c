@@ -22,6 +22,7 @@
 #endif
 
 #include <sys/types.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -53,27 +54,95 @@
 # define my_free(ptr) free (ptr)
 #endif
 
-/* Copy extended attributes from src_path to dst_path. If the file
-   has an extended Access ACL (system.posix_acl_access) and that is
-   copied successfully, the file mode permission bits are copied as
-   a side effect. This may not always the case, so the file mode
-   and/or ownership must be copied separately. */
-int
-attr_copy_file(const char *src_path, const char *dst_path,
-	       int (*check) (const char *, struct error_context *),
-	       struct error_context *ctx)
+/* Both attr_copy_file() and attr_copy_fileat() end up here. Only
+   attr_copy_fileat() uses the *xattrat() calls; attr_copy_file() stays
+   with the classic path based calls, which ignore the directory file
+   descriptors and flags. */
+struct copy_ops {
+	ssize_t (*list) (int, const char *, int, char *, size_t);
+	ssize_t (*get) (int, const char *, int, const char *, void *, size_t);
+	int (*set) (int, const char *, int, const char *, const void *,
+		    size_t);
+};
+
+#if defined(HAVE_LISTXATTR) && defined(HAVE_GETXATTR) && \
+    defined(HAVE_SETXATTR)
+# define HAVE_COPY_ATTRS 1
+
+static ssize_t
+path_list (int dirfd, const char *path, int flags, char *list, size_t size)
+{
+	return llistxattr (path, list, size);
+}
+
+static ssize_t
+path_get (int dirfd, const char *path, int flags, const char *name,
+	  void *value, size_t size)
+{
+	return lgetxattr (path, name, value, size);
+}
+
+static int
+path_set (int dirfd, const char *path, int flags, const char *name,
+	  const void *value, size_t size)
+{
+	return lsetxattr (path, name, value, size, 0);
+}
+
+static const struct copy_ops path_ops = { path_list, path_get, path_set };
+#endif
+
+#if defined(HAVE_ATTR_LISTXATTRAT) && defined(HAVE_ATTR_GETXATTRAT) && \
+    defined(HAVE_ATTR_SETXATTRAT)
+# define HAVE_COPY_ATTRS 1
+# define HAVE_COPY_ATTRS_AT 1
+
+static int
+at_set (int dirfd, const char *path, int flags, const char *name,
+	const void *value, size_t size)
+{
+	return attr_setxattrat (dirfd, path, flags, name, value, size, 0);
+}
+
+static const struct copy_ops at_ops = {
+	attr_listxattrat, attr_getxattrat, at_set
+};
+#endif
+
+#if defined(HAVE_COPY_ATTRS)
+/* A bit for the namespace of NAME. Once setting an attribute failed with
+   ENOTSUP, the destination does not support that namespace, and the
+   remaining attributes in it are not read. Whether security.* and
+   system.* attributes are supported depends on the name, so 0 is
+   returned for them. */
+static unsigned int
+name_namespace(const char *name)
 {
-#if defined(HAVE_LISTXATTR) && defined(HAVE_GETXATTR) && defined(HAVE_SETXATTR)
-  	int ret = 0;
+	if (strncmp(name, "user.", 5) == 0)
+		return 1;
+	if (strncmp(name, "trusted.", 8) == 0)
+		return 2;
+	return 0;
+}
+
+static int
+copy_attrs(int src_dirfd, const char *src_path, int src_flags,
+	   int dst_dirfd, const char *dst_path, int dst_flags,
+	   const struct copy_ops *ops,
+	   int (*check) (const char *, struct error_context *),
+	   struct error_context *ctx)
+{
+	int ret = 0;
 	ssize_t size;
 	char *names = NULL, *end_names, *name, *value = NULL;
 	unsigned int setxattr_ENOTSUP = 0;
+	unsigned int unsupported = 0;  /* namespaces, see name_namespace() */
 
 	/* ignore acls by default */
 	if (check == NULL)
 		check = attr_copy_check_permissions;
 
-	size = llistxattr (src_path, NULL, 0);
+	size = ops->list (src_dirfd, src_path, src_flags, NULL, 0);
 	if (size < 0) {
 		if (errno != ENOSYS && errno != ENOTSUP) {
 			const char *qpath = quote (ctx, src_path);
@@ -89,7 +158,7 @@ attr_copy_file(const char *src_path, const char *dst_path,
 		ret = -1;
 		goto getout;
 	}
-	size = llistxattr (src_path, names, size);
+	size = ops->list (src_dirfd, src_path, src_flags, names, size);
 	if (size < 0) {
 		const char *qpath = quote (ctx, src_path);
 		error (ctx, _("listing attributes of %s"), qpath);
@@ -107,8 +176,13 @@ attr_copy_file(const char *src_path, const char *dst_path,
 		/* check if this attribute shall be preserved */
 		if (!*name || !check(name, ctx))
 			continue;
+		if (unsupported & name_namespace(name)) {
+			setxattr_ENOTSUP++;
+			continue;
+		}
 
-		size = lgetxattr (src_path, name, NULL, 0);
+		size = ops->get (src_dirfd, src_path, src_flags, name,
+				 NULL, 0);
 		if (size < 0) {
 			const char *qpath = quote (ctx, src_path);
 			const char *qname = quote (ctx, name);
@@ -124,8 +198,10 @@ attr_copy_file(const char *src_path, const char *dst_path,
 			free(old_value);
 			error (ctx, "");
 			ret = -1;
+			continue;
 		}
-		size = lgetxattr (src_path, name, value, size);
+		size = ops->get (src_dirfd, src_path, src_flags, name,
+				 value, size);
 		if (size < 0) {
 			const char *qpath = quote (ctx, src_path);
 			const char *qname = quote (ctx, name);
@@ -136,10 +212,12 @@ attr_copy_file(const char *src_path, const char *dst_path,
 			ret = -1;
 			continue;
 		}
-		if (lsetxattr (dst_path, name, value, size, 0) != 0) {
-			if (errno == ENOTSUP)
+		if (ops->set (dst_dirfd, dst_path, dst_flags, name,
+			      value, size) != 0) {
+			if (errno == ENOTSUP) {
 				setxattr_ENOTSUP++;
-			else {
+				unsupported |= name_namespace(name);
+			} else {
 				const char *qpath = quote (ctx, dst_path);
 				if (errno == ENOSYS) {
 					error (ctx, _("setting attributes for "
@@ -169,6 +247,44 @@ getout:
 	free (value);
 	my_free (names);
 	return ret;
+}
+#endif
+
+/* Copy extended attributes from src_path to dst_path. If the file
+   has an extended Access ACL (system.posix_acl_access) and that is
+   copied successfully, the file mode permission bits are copied as
+   a side effect. This may not always the case, so the file mode
+   and/or ownership must be copied separately. */
+int
+attr_copy_file(const char *src_path, const char *dst_path,
+	       int (*check) (const char *, struct error_context *),
+	       struct error_context *ctx)
+{
+#if defined(HAVE_LISTXATTR) && defined(HAVE_GETXATTR) && \
+    defined(HAVE_SETXATTR)
+	return copy_attrs (AT_FDCWD, src_path, AT_SYMLINK_NOFOLLOW,
+			   AT_FDCWD, dst_path, AT_SYMLINK_NOFOLLOW,
+			   &path_ops, check, ctx);
+#else
+	return 0;
+#endif
+}
+
+/* Like attr_copy_file(), but with src_path relative to src_dirfd and
+   dst_path relative to dst_dirfd. Symlinks are not followed; an empty
+   path refers to the directory file descriptor itself. */
+int
+attr_copy_fileat(int src_dirfd, const char *src_path,
+		 int dst_dirfd, const char *dst_path,
+		 int (*check) (const char *, struct error_context *),
+		 struct error_context *ctx)
+{
+#if defined(HAVE_COPY_ATTRS_AT)
+	return copy_attrs (src_dirfd, src_path, AT_SYMLINK_NOFOLLOW |
+			   (*src_path ? 0 : AT_EMPTY_PATH),
+			   dst_dirfd, dst_path, AT_SYMLINK_NOFOLLOW |
+			   (*dst_path ? 0 : AT_EMPTY_PATH),
+			   &at_ops, check, ctx);
 #else
 	return 0;
 #endif
@@ -0,0 +1,377 @@
+/*
+  File: attrd_client.c
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Client side of the attrd protocol, see <attr/attrd.h>. */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "attr/attrd.h"
+
+struct attrd {
+	int fd;
+};
+
+struct attrd_result {
+	int error;
+	size_t offset, len;  /* of the data in the response */
+};
+
+struct attrd_batch {
+	char *req;
+	size_t req_size, req_len;
+	uint32_t num_ops;
+
+	char *resp;
+	size_t resp_size;
+
+	struct attrd_result *results;
+	size_t results_size;
+	uint32_t num_results;
+};
+
+#define ATTRD_REQUEST_HEADER	(2 * sizeof(uint32_t))
+#define ATTRD_OP_HEADER		(2 * sizeof(uint8_t) + sizeof(uint16_t) + \
+				 2 * sizeof(uint32_t))
+#define ATTRD_RESULT_HEADER	(sizeof(int32_t) + sizeof(uint32_t))
+
+const char *attrd_socket_path(void)
+{
+	static char path[PATH_MAX];
+	const char *dir;
+
+	if (getenv("ATTRD_SOCKET"))
+		return getenv("ATTRD_SOCKET");
+	dir = getenv("XDG_RUNTIME_DIR");
+	if (dir && *dir &&
+	    snprintf(path, sizeof(path), "%s/attrd.sock", dir) <
+	    (int)sizeof(path))
+		return path;
+	return ATTRD_SOCKET;
+}
+
+struct attrd *attrd_connect(const char *socket_path)
+{
+	struct sockaddr_un addr;
+	struct attrd *attrd;
+
+	if (!socket_path)
+		socket_path = attrd_socket_path();
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	attrd = malloc(sizeof(*attrd));
+	if (!attrd)
+		return NULL;
+	attrd->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (attrd->fd < 0)
+		goto fail;
+	if (connect(attrd->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		int err = errno;
+
+		close(attrd->fd);
+		errno = err;
+		goto fail;
+	}
+	return attrd;
+
+fail:
+	free(attrd);
+	return NULL;
+}
+
+void attrd_disconnect(struct attrd *attrd)
+{
+	if (attrd) {
+		if (attrd->fd >= 0)
+			close(attrd->fd);
+		free(attrd);
+	}
+}
+
+static int grow(char **buf, size_t *size, size_t new_size)
+{
+	char *b;
+
+	if (new_size <= *size)
+		return 0;
+	if (new_size < 2 * *size)
+		new_size = 2 * *size;
+	b = realloc(*buf, new_size);
+	if (!b)
+		return -1;
+	*buf = b;
+	*size = new_size;
+	return 0;
+}
+
+struct attrd_batch *attrd_batch_new(void)
+{
+	struct attrd_batch *batch = calloc(1, sizeof(*batch));
+
+	if (batch)
+		attrd_batch_reset(batch);
+	return batch;
+}
+
+void attrd_batch_reset(struct attrd_batch *batch)
+{
+	batch->req_len = ATTRD_REQUEST_HEADER;
+	batch->num_ops = 0;
+	batch->num_results = 0;
+}
+
+void attrd_batch_free(struct attrd_batch *batch)
+{
+	if (batch) {
+		free(batch->req);
+		free(batch->resp);
+		free(batch->results);
+		free(batch);
+	}
+}
+
+static int add_op(struct attrd_batch *batch, uint8_t op, int flags,
+		  const char *path, const char *name,
+		  const void *value, size_t value_len)
+{
+	size_t path_len = strlen(path), name_len = name ? strlen(name) : 0;
+	uint8_t op_flags = flags;
+	uint16_t n16 = name_len;
+	uint32_t p32 = path_len, v32 = value_len;
+	size_t len = ATTRD_OP_HEADER + path_len + name_len + value_len;
+	char *p;
+
+	if (name_len > UINT16_MAX || path_len > UINT32_MAX ||
+	    value_len > UINT32_MAX ||
+	    batch->req_len + len > ATTRD_MAX_MESSAGE) {
+		errno = E2BIG;
+		return -1;
+	}
+	if (grow(&batch->req, &batch->req_size, batch->req_len + len))
+		return -1;
+	p = batch->req + batch->req_len;
+	*p++ = op;
+	*p++ = op_flags;
+	memcpy(p, &n16, sizeof(n16));
+	p += sizeof(n16);
+	memcpy(p, &p32, sizeof(p32));
+	p += sizeof(p32);
+	memcpy(p, &v32, sizeof(v32));
+	p += sizeof(v32);
+	memcpy(p, path, path_len);
+	p += path_len;
+	if (name_len) {
+		memcpy(p, name, name_len);
+		p += name_len;
+	}
+	if (value_len)
+		memcpy(p, value, value_len);
+	batch->req_len += len;
+	batch->num_results = 0;
+	return batch->num_ops++;
+}
+
+int attrd_get(struct attrd_batch *batch, const char *path, const char *name,
+	      int flags)
+{
+	return add_op(batch, ATTRD_GET, flags, path, name, NULL, 0);
+}
+
+int attrd_set(struct attrd_batch *batch, const char *path, const char *name,
+	      const void *value, size_t size, int flags)
+{
+	return add_op(batch, ATTRD_SET, flags, path, name, value, size);
+}
+
+int attrd_list(struct attrd_batch *batch, const char *path, int flags)
+{
+	return add_op(batch, ATTRD_LIST, flags, path, NULL, NULL, 0);
+}
+
+int attrd_remove(struct attrd_batch *batch, const char *path,
+		 const char *name, int flags)
+{
+	return add_op(batch, ATTRD_REMOVE, flags, path, name, NULL, 0);
+}
+
+int attrd_copy(struct attrd_batch *batch, const char *src_path,
+	       const char *dst_path, int flags)
+{
+	return add_op(batch, ATTRD_COPY, flags, src_path, NULL, dst_path,
+		      strlen(dst_path));
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t done = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (done < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += done;
+		len -= done;
+	}
+	return 0;
+}
+
+static int read_all(int fd, char *buf, size_t len)
+{
+	while (len) {
+		ssize_t done = read(fd, buf, len);
+
+		if (done < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (done == 0) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		buf += done;
+		len -= done;
+	}
+	return 0;
+}
+
+static int parse_response(struct attrd_batch *batch, size_t size)
+{
+	const char *p = batch->resp, *end = batch->resp + size;
+	uint32_t num, n;
+
+	if (size < sizeof(num))
+		goto invalid;
+	memcpy(&num, p, sizeof(num));
+	p += sizeof(num);
+	if (num != batch->num_ops)
+		goto invalid;
+	if (grow((char **)&batch->results, &batch->results_size,
+		 num * sizeof(*batch->results)))
+		return -1;
+	for (n = 0; n < num; n++) {
+		struct attrd_result *result = &batch->results[n];
+		int32_t error;
+		uint32_t len;
+
+		if (end - p < (ptrdiff_t)ATTRD_RESULT_HEADER)
+			goto invalid;
+		memcpy(&error, p, sizeof(error));
+		p += sizeof(error);
+		memcpy(&len, p, sizeof(len));
+		p += sizeof(len);
+		if ((size_t)(end - p) < len)
+			goto invalid;
+		result->error = error;
+		result->offset = p - batch->resp;
+		result->len = len;
+		p += len;
+	}
+	batch->num_results = num;
+	return 0;
+
+invalid:
+	errno = EPROTO;
+	return -1;
+}
+
+/*
+ * Send the batch and wait for the results. Fails only if the daemon
+ * cannot be reached or does not follow the protocol; the results of the
+ * individual operations are returned by attrd_result().
+ */
+int attrd_run(struct attrd *attrd, struct attrd_batch *batch)
+{
+	uint32_t size = batch->req_len - sizeof(uint32_t);
+	int err;
+
+	if (attrd->fd < 0) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	if (grow(&batch->req, &batch->req_size, batch->req_len))
+		return -1;
+	memcpy(batch->req, &size, sizeof(size));
+	memcpy(batch->req + sizeof(size), &batch->num_ops,
+	       sizeof(batch->num_ops));
+	batch->num_results = 0;
+	if (write_all(attrd->fd, batch->req, batch->req_len) != 0)
+		goto fail;
+
+	if (read_all(attrd->fd, (char *)&size, sizeof(size)) != 0)
+		goto fail;
+	if (size > ATTRD_MAX_MESSAGE) {
+		errno = EPROTO;
+		goto fail;
+	}
+	if (grow(&batch->resp, &batch->resp_size, size ? size : 1) ||
+	    read_all(attrd->fd, batch->resp, size) != 0 ||
+	    parse_response(batch, size) != 0)
+		goto fail;
+	return 0;
+
+fail:
+	/* The stream is no longer in step with the daemon. */
+	err = errno;
+	close(attrd->fd);
+	attrd->fd = -1;
+	errno = err;
+	return -1;
+}
+
+/*
+ * Return the result of operation N. On success, DATA and SIZE are set to
+ * the value or list of names, which remain valid until the batch is
+ * changed. On failure, errno is set to the error of the operation.
+ */
+int attrd_result(struct attrd_batch *batch, unsigned int n,
+		 const void **data, size_t *size)
+{
+	struct attrd_result *result;
+
+	if (n >= batch->num_results) {
+		errno = EINVAL;
+		return -1;
+	}
+	result = &batch->results[n];
+	if (result->error) {
+		errno = result->error;
+		return -1;
+	}
+	if (data)
+		*data = batch->resp + result->offset;
+	if (size)
+		*size = result->len;
+	return 0;
+}
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 
 #include <attr/xattr.h>
@@ -99,6 +100,22 @@ found:
 	return 0;
 }
 
+/*
+ * Map IRIX API flags to the flags of the *xattrat() calls. An empty path
+ * refers to the directory file descriptor itself.
+ */
+static int
+api_at_flags(const char *path, int irixflags)
+{
+	int at_flags = 0;
+
+	if (irixflags & ATTR_DONTFOLLOW)
+		at_flags |= AT_SYMLINK_NOFOLLOW;
+	if (*path == '\0')
+		at_flags |= AT_EMPTY_PATH;
+	return at_flags;
+}
+
 
 int
 attr_get(const char *path, const char *attrname, char *attrvalue,
@@ -145,6 +162,28 @@ attr_getf(int fd, const char *attrname, char *attrvalue,
 	return 0;
 }
 
+int
+attr_getat(int dirfd, const char *path, const char *attrname,
+	   char *attrvalue, int *valuelength, int flags)
+{
+	int c, compat;
+	char name[MAXNAMELEN+16];
+
+	for (compat = 0; compat < 2; compat++) {
+		if ((c = api_convert(name, attrname, flags, compat)) < 0)
+			return c;
+		c = attr_getxattrat(dirfd, path, api_at_flags(path, flags),
+				    name, attrvalue, *valuelength);
+		if (c < 0 && (errno == ENOATTR || errno == ENOTSUP))
+			continue;
+		break;
+	}
+	if (c < 0)
+		return c;
+	*valuelength = c;
+	return 0;
+}
+
 int
 attr_set(const char *path, const char *attrname, const char *attrvalue,
 	 const int valuelength, int flags)
@@ -196,6 +235,30 @@ attr_setf(int fd, const char *attrname,
 	return c;
 }
 
+int
+attr_setat(int dirfd, const char *path, const char *attrname,
+	   const char *attrvalue, const int valuelength, int flags)
+{
+	int c, compat, lflags = 0;
+	char name[MAXNAMELEN+16];
+
+	if (flags & ATTR_CREATE)
+		lflags = XATTR_CREATE;
+	else if (flags & ATTR_REPLACE)
+		lflags = XATTR_REPLACE;
+
+	for (compat = 0; compat < 2; compat++) {
+		if ((c = api_convert(name, attrname, flags, compat)) < 0)
+			return c;
+		c = attr_setxattrat(dirfd, path, api_at_flags(path, flags),
+				    name, attrvalue, valuelength, lflags);
+		if (c < 0 && (errno == ENOATTR || errno == ENOTSUP))
+			continue;
+		break;
+	}
+	return c;
+}
+
 int
 attr_remove(const char *path, const char *attrname, int flags)
 {
@@ -233,6 +296,24 @@ attr_removef(int fd, const char *attrname, int flags)
 	return c;
 }
 
+int
+attr_removeat(int dirfd, const char *path, const char *attrname, int flags)
+{
+	int c, compat;
+	char name[MAXNAMELEN+16];
+
+	for (compat = 0; compat < 2; compat++) {
+		if ((c = api_convert(name, attrname, flags, compat)) < 0)
+			return c;
+		c = attr_removexattrat(dirfd, path, api_at_flags(path, flags),
+				       name);
+		if (c < 0 && (errno == ENOATTR || errno == ENOTSUP))
+			continue;
+		break;
+	}
+	return c;
+}
+
 
 /*
  * Helper routine for attr_list functions.
@@ -349,6 +430,48 @@ attr_listf(int fd, char *buffer, const int buffersize, int flags,
 	return 0;
 }
 
+int
+attr_listat(int dirfd, const char *path, char *buffer, const int buffersize,
+	    int flags, attrlist_cursor_t *cursor)
+{
+	const char *l;
+	int length, vlength, count = 0;
+	char lbuf[MAXLISTLEN];
+	char name[MAXNAMELEN+16];
+	int start_offset, end_offset;
+	int at_flags = api_at_flags(path, flags);
+
+	if (buffersize < sizeof(attrlist_t)) {
+		errno = EINVAL;
+		return -1;
+	}
+	bzero(buffer, sizeof(attrlist_t));
+
+	length = attr_listxattrat(dirfd, path, at_flags, lbuf,
+				  sizeof(lbuf));
+	if (length <= 0)
+		return length;
+
+	start_offset = sizeof(attrlist_t);
+	end_offset = buffersize & ~(8-1);	/* 8 byte align */
+
+	for (l = lbuf; l != lbuf + length; l = strchr(l, '\0') + 1) {
+		if (api_unconvert(name, l, flags))
+			continue;
+		vlength = attr_getxattrat(dirfd, path, at_flags, l, NULL, 0);
+		if (vlength < 0 && (errno == ENOATTR || errno == ENOTSUP))
+			continue;
+		if (count++ < cursor->opaque[0])
+			continue;
+		if (attr_list_pack(name, vlength, buffer, buffersize,
+				   &start_offset, &end_offset)) {
+			cursor->opaque[0] = count;
+			break;
+		}
+	}
+	return 0;
+}
+
 
 /*
  * Helper routines for the attr_multi functions.  In IRIX, the
@@ -392,6 +515,24 @@ attr_singlef(const int fd, attr_multiop_t *op, int flags)
 	return r;
 }
 
+static int
+attr_singleat(int dirfd, const char *path, attr_multiop_t *op, int flags)
+{
+	int r = -1;
+
+	errno = -EINVAL;
+	flags |= op->am_flags;
+	if (op->am_opcode & ATTR_OP_GET)
+		r = attr_getat(dirfd, path, op->am_attrname,
+				op->am_attrvalue, &op->am_length, flags);
+	else if (op->am_opcode & ATTR_OP_SET)
+		r = attr_setat(dirfd, path, op->am_attrname,
+				op->am_attrvalue, op->am_length, flags);
+	else if (op->am_opcode & ATTR_OP_REMOVE)
+		r = attr_removeat(dirfd, path, op->am_attrname, flags);
+	return r;
+}
+
 /*
  * Operate on multiple attributes of the same object simultaneously
  *
@@ -432,3 +573,21 @@ attr_multif(int fd, attr_multiop_t *multiops, int count, int flags)
 	}
 	return r;
 }
+
+int
+attr_multiat(int dirfd, const char *path, attr_multiop_t *multiops,
+	     int count, int flags)
+{
+	int i, tmp, r = -1;
+
+	errno = EINVAL;
+	if ((flags & ATTR_DONTFOLLOW) != flags)
+		return r;
+
+	r = errno = 0;
+	for (i = 0; i < count; i++) {
+		tmp = attr_singleat(dirfd, path, &multiops[i], flags);
+		if (tmp) r = tmp;
+	}
+	return r;
+}
@@ -10,3 +10,6 @@
 #define HAVE_GETXATTR 1
 #define HAVE_LISTXATTR 1
 #define HAVE_SETXATTR 1
+#define HAVE_ATTR_GETXATTRAT 1
+#define HAVE_ATTR_LISTXATTRAT 1
+#define HAVE_ATTR_SETXATTRAT 1
@@ -23,6 +23,10 @@
 
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
 
 #if defined (__i386__)
 # define HAVE_XATTR_SYSCALLS 1
@@ -38,6 +42,10 @@
 # define __NR_removexattr	235
 # define __NR_lremovexattr	236
 # define __NR_fremovexattr	237
+# define __NR_setxattrat	463
+# define __NR_getxattrat	464
+# define __NR_listxattrat	465
+# define __NR_removexattrat	466
 #elif defined (__sparc__)
 # define HAVE_XATTR_SYSCALLS 1
 # define __NR_setxattr		169
@@ -52,6 +60,10 @@
 # define __NR_removexattr	181
 # define __NR_lremovexattr	182
 # define __NR_fremovexattr	186
+# define __NR_setxattrat	463
+# define __NR_getxattrat	464
+# define __NR_listxattrat	465
+# define __NR_removexattrat	466
 #elif defined (__ia64__)
 # define HAVE_XATTR_SYSCALLS 1
 # define __NR_setxattr		1217
@@ -80,6 +92,10 @@
 # define __NR_removexattr	218
 # define __NR_lremovexattr	219
 # define __NR_fremovexattr	220
+# define __NR_setxattrat	463
+# define __NR_getxattrat	464
+# define __NR_listxattrat	465
+# define __NR_removexattrat	466
 #elif defined (__x86_64__)
 # define HAVE_XATTR_SYSCALLS 1
 # define __NR_setxattr		188
@@ -94,6 +110,10 @@
 # define __NR_removexattr	197
 # define __NR_lremovexattr	198
 # define __NR_fremovexattr	199
+# define __NR_setxattrat	463
+# define __NR_getxattrat	464
+# define __NR_listxattrat	465
+# define __NR_removexattrat	466
 #elif defined (__s390__)
 # define HAVE_XATTR_SYSCALLS 1
 # define __NR_setxattr		224
@@ -108,6 +128,10 @@
 # define __NR_removexattr	233
 # define __NR_lremovexattr	234
 # define __NR_fremovexattr	235
+# define __NR_setxattrat	463
+# define __NR_getxattrat	464
+# define __NR_listxattrat	465
+# define __NR_removexattrat	466
 #elif defined (__arm__)
 # define HAVE_XATTR_SYSCALLS 1
 # if defined(__ARM_EABI__) || defined(__thumb__)
@@ -127,6 +151,10 @@
 # define __NR_removexattr	(__NR_SYSCALL_BASE+235)
 # define __NR_lremovexattr	(__NR_SYSCALL_BASE+236)
 # define __NR_fremovexattr	(__NR_SYSCALL_BASE+237)
+# define __NR_setxattrat	(__NR_SYSCALL_BASE+463)
+# define __NR_getxattrat	(__NR_SYSCALL_BASE+464)
+# define __NR_listxattrat	(__NR_SYSCALL_BASE+465)
+# define __NR_removexattrat	(__NR_SYSCALL_BASE+466)
 #elif defined (__mips64)
 # define HAVE_XATTR_SYSCALLS 1
 # ifdef __LP64__ /* mips64 using n64 ABI */
@@ -146,6 +174,10 @@
 # define __NR_removexattr	(__NR_Linux + 189)
 # define __NR_lremovexattr	(__NR_Linux + 190)
 # define __NR_fremovexattr	(__NR_Linux + 191)
+# define __NR_setxattrat	(__NR_Linux + 463)
+# define __NR_getxattrat	(__NR_Linux + 464)
+# define __NR_listxattrat	(__NR_Linux + 465)
+# define __NR_removexattrat	(__NR_Linux + 466)
 #elif defined (__mips__) /* mips32, or mips64 using o32 ABI */
 # define HAVE_XATTR_SYSCALLS 1
 # define __NR_Linux 4000
@@ -161,6 +193,10 @@
 # define __NR_removexattr	(__NR_Linux + 233)
 # define __NR_lremovexattr	(__NR_Linux + 234)
 # define __NR_fremovexattr	(__NR_Linux + 235)
+# define __NR_setxattrat	(__NR_Linux + 463)
+# define __NR_getxattrat	(__NR_Linux + 464)
+# define __NR_listxattrat	(__NR_Linux + 465)
+# define __NR_removexattrat	(__NR_Linux + 466)
 #elif defined (__alpha__)
 # define HAVE_XATTR_SYSCALLS 1
 # define __NR_setxattr		382
@@ -175,6 +211,10 @@
 # define __NR_removexattr	391
 # define __NR_lremovexattr	392
 # define __NR_fremovexattr	393
+# define __NR_setxattrat	573
+# define __NR_getxattrat	574
+# define __NR_listxattrat	575
+# define __NR_removexattrat	576
 #elif defined (__mc68000__)
 # define HAVE_XATTR_SYSCALLS 1
 # define __NR_setxattr		223
@@ -189,6 +229,10 @@
 # define __NR_removexattr	232
 # define __NR_lremovexattr	233
 # define __NR_fremovexattr	234
+# define __NR_setxattrat	463
+# define __NR_getxattrat	464
+# define __NR_listxattrat	465
+# define __NR_removexattrat	466
 #else
 # warning "Extended attribute syscalls undefined for this architecture"
 # define HAVE_XATTR_SYSCALLS 0
@@ -265,3 +309,210 @@ int fremovexattr (int filedes, const char *name)
 {
 	return SYSCALL(__NR_fremovexattr, filedes, name);
 }
+
+/*
+ * The *xattrat() system calls are only available in recent kernels.
+ * Without them, the object is resolved by path: absolute paths and paths
+ * relative to AT_FDCWD are used directly, while other paths and empty
+ * paths go through /proc/self/fd.
+ */
+
+struct xattr_args {
+	uint64_t value;
+	uint32_t size;
+	uint32_t flags;
+};
+
+#if defined(__NR_setxattrat)
+static int have_xattrat = -1;  /* not probed yet */
+#else
+static int have_xattrat = 0;
+# define __NR_setxattrat	-1
+# define __NR_getxattrat	-1
+# define __NR_listxattrat	-1
+# define __NR_removexattrat	-1
+#endif
+
+#define XATTRAT_PATH_MAX	(PATH_MAX + 32)
+
+static const char *xattrat_path(int dirfd, const char *path, int at_flags,
+				char *buf, int *follow)
+{
+	int len;
+
+	if (at_flags & ~(AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	*follow = !(at_flags & AT_SYMLINK_NOFOLLOW);
+	if (*path == '\0') {
+		if (!(at_flags & AT_EMPTY_PATH)) {
+			errno = ENOENT;
+			return NULL;
+		}
+		/* The magic link resolves to the object itself. */
+		*follow = 1;
+		if (dirfd == AT_FDCWD)
+			return ".";
+		len = snprintf(buf, XATTRAT_PATH_MAX, "/proc/self/fd/%d",
+			       dirfd);
+	} else if (*path == '/' || dirfd == AT_FDCWD)
+		return path;
+	else
+		len = snprintf(buf, XATTRAT_PATH_MAX, "/proc/self/fd/%d/%s",
+			       dirfd, path);
+	if (len >= XATTRAT_PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	return buf;
+}
+
+/* An empty path refers to DIRFD, which can be used directly. */
+#define xattrat_fd(dirfd, path, at_flags) \
+	(*(path) == '\0' && ((at_flags) & AT_EMPTY_PATH) && \
+	 (dirfd) != AT_FDCWD)
+
+/*
+ * Probe for the *xattrat() system calls once. Besides kernels which lack
+ * them (ENOSYS), seccomp filters of container runtimes commonly reject
+ * system calls they do not know with EPERM; listing the attributes of the
+ * root directory fails with EPERM for no other reason.
+ */
+static int xattrat_available(void)
+{
+	if (have_xattrat < 0) {
+		int err = errno;
+		long ret = SYSCALL(__NR_listxattrat, AT_FDCWD, "/", 0,
+				   NULL, 0);
+
+		have_xattrat = ret >= 0 ||
+			       (errno != ENOSYS && errno != EPERM);
+		errno = err;
+	}
+	return have_xattrat;
+}
+
+/*
+ * Check whether a failed *xattrat() system call is final. Fall back to
+ * the emulation when the kernel lacks the system calls, and for O_PATH
+ * file descriptors which some kernels reject with EBADF.
+ */
+static int xattrat_final(int dirfd, const char *path, int at_flags)
+{
+	if (errno == ENOSYS) {
+		have_xattrat = 0;
+		return 0;
+	}
+	return !(errno == EBADF && xattrat_fd(dirfd, path, at_flags));
+}
+
+int attr_setxattrat (int dirfd, const char *path, int at_flags,
+			const char *name, const void *value, size_t size,
+			int flags)
+{
+	char buf[XATTRAT_PATH_MAX];
+	const char *p;
+	int follow, ret;
+
+	if (xattrat_available()) {
+		struct xattr_args args = {
+			.value = (uintptr_t)value,
+			.size = size > UINT32_MAX ? UINT32_MAX : size,
+			.flags = flags,
+		};
+
+		ret = SYSCALL(__NR_setxattrat, dirfd, path, at_flags, name,
+			      &args, sizeof(args));
+		if (ret >= 0 || xattrat_final(dirfd, path, at_flags))
+			return ret;
+	}
+	p = xattrat_path(dirfd, path, at_flags, buf, &follow);
+	if (!p)
+		return -1;
+	if (xattrat_fd(dirfd, path, at_flags)) {
+		ret = fsetxattr(dirfd, name, (void *)value, size, flags);
+		if (ret >= 0 || errno != EBADF)
+			return ret;
+	}
+	return (follow ? setxattr : lsetxattr)(p, name, (void *)value,
+					       size, flags);
+}
+
+ssize_t attr_getxattrat (int dirfd, const char *path, int at_flags,
+			const char *name, void *value, size_t size)
+{
+	char buf[XATTRAT_PATH_MAX];
+	const char *p;
+	int follow;
+	ssize_t ret;
+
+	if (xattrat_available()) {
+		struct xattr_args args = {
+			.value = (uintptr_t)value,
+			.size = size > UINT32_MAX ? UINT32_MAX : size,
+		};
+
+		ret = SYSCALL(__NR_getxattrat, dirfd, path, at_flags, name,
+			      &args, sizeof(args));
+		if (ret >= 0 || xattrat_final(dirfd, path, at_flags))
+			return ret;
+	}
+	p = xattrat_path(dirfd, path, at_flags, buf, &follow);
+	if (!p)
+		return -1;
+	if (xattrat_fd(dirfd, path, at_flags)) {
+		ret = fgetxattr(dirfd, name, value, size);
+		if (ret >= 0 || errno != EBADF)
+			return ret;
+	}
+	return (follow ? getxattr : lgetxattr)(p, name, value, size);
+}
+
+ssize_t attr_listxattrat (int dirfd, const char *path, int at_flags,
+			char *list, size_t size)
+{
+	char buf[XATTRAT_PATH_MAX];
+	const char *p;
+	int follow;
+	ssize_t ret;
+
+	if (xattrat_available()) {
+		ret = SYSCALL(__NR_listxattrat, dirfd, path, at_flags,
+			      list, size);
+		if (ret >= 0 || xattrat_final(dirfd, path, at_flags))
+			return ret;
+	}
+	p = xattrat_path(dirfd, path, at_flags, buf, &follow);
+	if (!p)
+		return -1;
+	if (xattrat_fd(dirfd, path, at_flags)) {
+		ret = flistxattr(dirfd, list, size);
+		if (ret >= 0 || errno != EBADF)
+			return ret;
+	}
+	return (follow ? listxattr : llistxattr)(p, list, size);
+}
+
+int attr_removexattrat (int dirfd, const char *path, int at_flags,
+			const char *name)
+{
+	char buf[XATTRAT_PATH_MAX];
+	const char *p;
+	int follow, ret;
+
+	if (xattrat_available()) {
+		ret = SYSCALL(__NR_removexattrat, dirfd, path, at_flags, name);
+		if (ret >= 0 || xattrat_final(dirfd, path, at_flags))
+			return ret;
+	}
+	p = xattrat_path(dirfd, path, at_flags, buf, &follow);
+	if (!p)
+		return -1;
+	if (xattrat_fd(dirfd, path, at_flags)) {
+		ret = fremovexattr(dirfd, name);
+		if (ret >= 0 || errno != EBADF)
+			return ret;
+	}
+	return (follow ? removexattr : lremovexattr)(p, name);
+}
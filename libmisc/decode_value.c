@@ -0,0 +1,185 @@
+/*
+  File: decode_value.c
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "misc.h"
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else
+		return -1;
+}
+
+static int base64_digit(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A';
+	else if (c >= 'a' && c <= 'z')
+		return 26 + c - 'a';
+	else if (c >= '0' && c <= '9')
+		return 52 + c - '0';
+	else if (c == '+')
+		return 62;
+	else if (c == '/')
+		return 63;
+	else if (c == '=')
+		return -2;
+	else
+		return -1;
+}
+
+/*
+ * Decode the SIZE bytes at VALUE into DECODED, which must have room for
+ * SIZE bytes: no encoding produces more bytes than it consumes. VALUE
+ * need not be '\0'-terminated. Returns the decoded size, or -1 on
+ * errors (EINVAL).
+ */
+ssize_t decode_value(const char *value, size_t size, char *decoded)
+{
+	const char *end = value + size;
+	char *d = decoded;
+
+	if (size >= 2 && value[0] == '0' &&
+	    (value[1] == 'x' || value[1] == 'X')) {
+		const char *v = value+2;
+
+		while (v < end) {
+			int d1, d0;
+
+			while (v < end && isspace(*v))
+				v++;
+			if (v == end)
+				break;
+			d1 = hex_digit(*v++);
+			while (v < end && isspace(*v))
+				v++;
+			if (v == end) {
+		bad_hex_encoding:
+				errno = EINVAL;
+				return -1;
+			}
+			d0 = hex_digit(*v++);
+			if (d1 < 0 || d0 < 0)
+				goto bad_hex_encoding;
+			*d++ = ((d1 << 4) | d0);
+		}
+	} else if (size >= 2 && value[0] == '0' &&
+		   (value[1] == 's' || value[1] == 'S')) {
+		const char *v = value+2;
+		int d0, d1, d2, d3;
+
+		for(;;) {
+			while (v < end && isspace(*v))
+				v++;
+			if (v == end) {
+				d0 = d1 = d2 = d3 = -2;
+				break;
+			}
+			if (v + 4 > end) {
+		bad_base64_encoding:
+				errno = EINVAL;
+				return -1;
+			}
+			d0 = base64_digit(*v++);
+			d1 = base64_digit(*v++);
+			d2 = base64_digit(*v++);
+			d3 = base64_digit(*v++);
+			if (d0 < 0 || d1 < 0 || d2 < 0 || d3 < 0)
+				break;
+
+			*d++ = (char)((d0 << 2) | (d1 >> 4));
+			*d++ = (char)((d1 << 4) | (d2 >> 2));
+			*d++ = (char)((d2 << 6) | d3);
+		}
+		if (d0 == -2) {
+			if (d1 != -2 || d2 != -2 || d3 != -2)
+				goto bad_base64_encoding;
+			goto base64_end;
+		}
+		if (d0 == -1 || d1 < 0 || d2 == -1 || d3 == -1)
+			goto bad_base64_encoding;
+		*d++ = (char)((d0 << 2) | (d1 >> 4));
+		if (d2 != -2)
+			*d++ = (char)((d1 << 4) | (d2 >> 2));
+		else {
+			if (d1 & 0x0F || d3 != -2)
+				goto bad_base64_encoding;
+			goto base64_end;
+		}
+		if (d3 != -2)
+			*d++ = (char)((d2 << 6) | d3);
+		else if (d2 & 0x03)
+			goto bad_base64_encoding;
+	base64_end:
+		while (v < end && isspace(*v))
+			v++;
+		if (v + 4 <= end && *v == '=') {
+			if (*++v != '=' || *++v != '=' || *++v != '=')
+				goto bad_base64_encoding;
+			v++;
+		}
+		while (v < end && isspace(*v))
+			v++;
+		if (v < end)
+			goto bad_base64_encoding;
+	} else {
+		const char *v = value;
+
+		if (end > v+1 && *v == '"' && *(end-1) == '"') {
+			v++;
+			end--;
+		}
+
+		while (v < end) {
+			const char *bs = memchr(v, '\\', end - v);
+
+			/* Copy runs without escapes in one go. */
+			if (!bs)
+				bs = end;
+			memcpy(d, v, bs - v);
+			d += bs - v;
+			v = bs;
+			if (v == end)
+				break;
+			if (v + 1 < end && (v[1] == '\\' || v[1] == '"')) {
+				*d++ = *++v; v++;
+			} else if (v + 1 < end && v[1] >= '0' && v[1] <= '7') {
+				int c = 0;
+				v++;
+				c = (*v++ - '0');
+				if (v < end && *v >= '0' && *v <= '7')
+					c = (c << 3) + (*v++ - '0');
+				if (v < end && *v >= '0' && *v <= '7')
+					c = (c << 3) + (*v++ - '0');
+				*d++ = c;
+			} else
+				*d++ = *v++;
+		}
+	}
+	return d - decoded;
+}
@@ -0,0 +1,220 @@
+/*
+  File: fs_caps.c
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <sys/types.h>
+#include <sys/vfs.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <attr/xattr.h>
+#include "fs_caps.h"
+
+#define FS_CAPS_SIZE	64  /* filesystems in the cache */
+#define FS_CAPS_TTL	60  /* seconds before an entry is examined again */
+
+enum { NS_USER, NS_TRUSTED, NS_SECURITY, NS_SYSTEM, NS_OTHER, NS_MAX };
+
+struct fs_caps_entry {
+	dev_t dev;
+	int valid;
+	time_t expires;
+	int probed;  /* f_type and listxattr() checked */
+	int pseudo;
+	unsigned char unsupported[NS_MAX];
+};
+
+static struct fs_caps_entry cache[FS_CAPS_SIZE];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Filesystems which only export kernel state. */
+static const unsigned long pseudo_types[] = {
+	0x9fa0,		/* proc */
+	0x62656572,	/* sysfs */
+	0x27e0eb,	/* cgroup */
+	0x63677270,	/* cgroup2 */
+	0x64626720,	/* debugfs */
+	0x74726163,	/* tracefs */
+	0x73636673,	/* securityfs */
+	0x1cd1,		/* devpts */
+	0x6165676c,	/* pstore */
+	0xcafe4a11,	/* bpf */
+	0x62656570,	/* configfs */
+	0x42494e4d,	/* binfmt_misc */
+	0x65735543,	/* fusectl */
+	0x19800202,	/* mqueue */
+	0x6e736673,	/* nsfs */
+	0xde5e81e4,	/* efivarfs */
+};
+
+static int name_namespace(const char *name)
+{
+	if (*name == '\0')
+		return NS_MAX;  /* all namespaces */
+	if (strncmp(name, "user.", 5) == 0)
+		return NS_USER;
+	if (strncmp(name, "trusted.", 8) == 0)
+		return NS_TRUSTED;
+	if (strncmp(name, "security.", 9) == 0)
+		return NS_SECURITY;
+	if (strncmp(name, "system.", 7) == 0)
+		return NS_SYSTEM;
+	return NS_OTHER;
+}
+
+static time_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/*
+ * Entries expire, so that a filesystem which is remounted with different
+ * options, or a device number which is reused by another mount, is
+ * noticed by long-running processes. Called with cache_lock held.
+ */
+static struct fs_caps_entry *find_entry(dev_t dev)
+{
+	struct fs_caps_entry *entry = &cache[dev % FS_CAPS_SIZE];
+
+	if (!entry->valid || entry->dev != dev || now() >= entry->expires)
+		return NULL;
+	return entry;
+}
+
+/* Called with cache_lock held. */
+static struct fs_caps_entry *get_entry(dev_t dev)
+{
+	struct fs_caps_entry *entry = find_entry(dev);
+
+	if (!entry) {
+		entry = &cache[dev % FS_CAPS_SIZE];
+		memset(entry, 0, sizeof(*entry));
+		entry->dev = dev;
+		entry->valid = 1;
+		entry->expires = now() + FS_CAPS_TTL;
+	}
+	return entry;
+}
+
+static int all_unsupported(const struct fs_caps_entry *entry)
+{
+	int n;
+
+	for (n = 0; n < NS_MAX; n++)
+		if (!entry->unsupported[n])
+			return 0;
+	return 1;
+}
+
+static int entry_caps(const struct fs_caps_entry *entry)
+{
+	return (entry->pseudo ? FS_CAPS_PSEUDO : 0) |
+	       (all_unsupported(entry) ? FS_CAPS_NO_XATTR : 0);
+}
+
+static void probe(const char *path, int *pseudo, int *no_xattr)
+{
+	struct statfs buf;
+	int n;
+
+	*pseudo = 0;
+	if (statfs(path, &buf) == 0) {
+		for (n = 0; n < sizeof(pseudo_types) / sizeof(*pseudo_types);
+		     n++)
+			if ((unsigned long)buf.f_type == pseudo_types[n])
+				*pseudo = 1;
+	}
+	*no_xattr = listxattr(path, NULL, 0) < 0 &&
+		    (errno == ENOTSUP || errno == ENOSYS);
+}
+
+/*
+ * Return the FS_CAPS_* flags of the filesystem DEV. Unless it has been
+ * seen before, PATH, which must be on that filesystem, is examined; if
+ * PATH is NULL, only what is already known is returned.
+ */
+int fs_caps(dev_t dev, const char *path)
+{
+	struct fs_caps_entry *entry;
+	int caps = 0, pseudo, no_xattr;
+
+	pthread_mutex_lock(&cache_lock);
+	entry = find_entry(dev);
+	if (entry && (entry->probed || !path)) {
+		caps = entry_caps(entry);
+		pthread_mutex_unlock(&cache_lock);
+		return caps;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	if (!path)
+		return 0;
+
+	probe(path, &pseudo, &no_xattr);
+
+	pthread_mutex_lock(&cache_lock);
+	entry = get_entry(dev);
+	entry->probed = 1;
+	entry->pseudo = pseudo;
+	if (no_xattr)
+		memset(entry->unsupported, 1, sizeof(entry->unsupported));
+	caps = entry_caps(entry);
+	pthread_mutex_unlock(&cache_lock);
+	return caps;
+}
+
+/*
+ * Check whether the namespace of NAME is known to be unsupported on DEV;
+ * the empty name stands for all namespaces.
+ */
+int fs_caps_unsupported(dev_t dev, const char *name)
+{
+	struct fs_caps_entry *entry;
+	int ns = name_namespace(name), unsupported = 0;
+
+	pthread_mutex_lock(&cache_lock);
+	entry = find_entry(dev);
+	if (entry) {
+		if (ns < NS_MAX)
+			unsupported = entry->unsupported[ns];
+		else
+			unsupported = all_unsupported(entry);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return unsupported;
+}
+
+/*
+ * Remember that an operation on NAME (or on all names, if NAME is empty)
+ * failed with EOPNOTSUPP on DEV.
+ */
+void fs_caps_set_unsupported(dev_t dev, const char *name)
+{
+	struct fs_caps_entry *entry;
+	int ns = name_namespace(name), n;
+
+	pthread_mutex_lock(&cache_lock);
+	entry = get_entry(dev);
+	for (n = 0; n < NS_MAX; n++)
+		if (ns == NS_MAX || n == ns)
+			entry->unsupported[n] = 1;
+	pthread_mutex_unlock(&cache_lock);
+}
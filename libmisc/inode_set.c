@@ -0,0 +1,161 @@
+/*
+  File: inode_set.c
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "inode_set.h"
+
+/*
+ * Open addressing with linear probing. Paths are kept back to back in a
+ * single buffer, so that an entry only takes up a few words.
+ */
+struct inode_entry {
+	dev_t dev;
+	ino_t ino;
+	size_t path;  /* offset in paths + 1, or 0 for an unused slot */
+	int value;
+};
+
+struct inode_set {
+	struct inode_entry *table;
+	size_t size, used;
+	char *paths;
+	size_t paths_size, paths_len;
+	size_t max_bytes;
+};
+
+struct inode_set *inode_set_create(size_t max_bytes)
+{
+	struct inode_set *set = calloc(1, sizeof(*set));
+
+	if (set)
+		set->max_bytes = max_bytes;
+	return set;
+}
+
+void inode_set_free(struct inode_set *set)
+{
+	if (set) {
+		free(set->table);
+		free(set->paths);
+		free(set);
+	}
+}
+
+static struct inode_entry *inode_slot(struct inode_entry *table, size_t size,
+				      dev_t dev, ino_t ino)
+{
+	size_t h = ((unsigned long long)dev * 0x9e3779b97f4a7c15ULL) ^
+		   ((unsigned long long)ino * 0xc2b2ae3d27d4eb4fULL);
+
+	for (h = (h ^ (h >> 29)) & (size - 1); table[h].path;
+	     h = (h + 1) & (size - 1))
+		if (table[h].ino == ino && table[h].dev == dev)
+			break;
+	return &table[h];
+}
+
+/*
+ * Return the path with which inode DEV:INO was added, and its value in
+ * *VALUE, or NULL if it is not in the set. The path remains valid until
+ * the next inode_set_add().
+ */
+const char *inode_set_find(struct inode_set *set, dev_t dev, ino_t ino,
+			   int *value)
+{
+	struct inode_entry *entry;
+
+	if (!set->used)
+		return NULL;
+	entry = inode_slot(set->table, set->size, dev, ino);
+	if (!entry->path)
+		return NULL;
+	if (value)
+		*value = entry->value;
+	return set->paths + entry->path - 1;
+}
+
+static int grow_table(struct inode_set *set)
+{
+	size_t size = set->size ? 2 * set->size : 1024, n;
+	struct inode_entry *table;
+
+	if (size * sizeof(*table) + set->paths_size > set->max_bytes) {
+		errno = ENOSPC;
+		return -1;
+	}
+	table = calloc(size, sizeof(*table));
+	if (!table)
+		return -1;
+	for (n = 0; n < set->size; n++)
+		if (set->table[n].path)
+			*inode_slot(table, size, set->table[n].dev,
+				    set->table[n].ino) = set->table[n];
+	free(set->table);
+	set->table = table;
+	set->size = size;
+	return 0;
+}
+
+static int grow_paths(struct inode_set *set, size_t len)
+{
+	size_t size = set->paths_size ? set->paths_size : 4096;
+	char *paths;
+
+	while (size < set->paths_len + len)
+		size *= 2;
+	if (size == set->paths_size)
+		return 0;
+	if (set->size * sizeof(*set->table) + size > set->max_bytes) {
+		errno = ENOSPC;
+		return -1;
+	}
+	paths = realloc(set->paths, size);
+	if (!paths)
+		return -1;
+	set->paths = paths;
+	set->paths_size = size;
+	return 0;
+}
+
+/*
+ * Add inode DEV:INO, which must not be in the set yet. Fails with ENOSPC
+ * once the set is full.
+ */
+int inode_set_add(struct inode_set *set, dev_t dev, ino_t ino,
+		  const char *path, int value)
+{
+	size_t len = strlen(path) + 1;
+	struct inode_entry *entry;
+
+	if (2 * (set->used + 1) > set->size && grow_table(set) != 0)
+		return -1;
+	if (grow_paths(set, len) != 0)
+		return -1;
+	memcpy(set->paths + set->paths_len, path, len);
+	entry = inode_slot(set->table, set->size, dev, ino);
+	entry->dev = dev;
+	entry->ino = ino;
+	entry->path = set->paths_len + 1;
+	entry->value = value;
+	set->paths_len += len;
+	set->used++;
+	return 0;
+}
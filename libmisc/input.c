@@ -0,0 +1,273 @@
+/*
+  File: input.c
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "misc.h"
+#include "input.h"
+
+#define INPUT_BUFFER_SIZE	(1 << 20)
+
+/*
+ * Map a regular file. Input which does not start at the beginning of the
+ * file, like standard input after an earlier partial read, is read instead.
+ */
+static int input_map(struct input *in)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(in->fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size == 0 || (off_t)(size_t)st.st_size != st.st_size ||
+	    lseek(in->fd, 0, SEEK_CUR) != 0)
+		return -1;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	in->buf = map;
+	in->size = in->end = st.st_size;
+	in->flags |= INPUT_MMAP | INPUT_EOF;
+	return 0;
+}
+
+/*
+ * Copy the rest of the input into an unlinked temporary file, and
+ * continue with that file instead.
+ */
+static int input_spool(struct input *in)
+{
+	FILE *tmp = tmpfile();
+	char *buf;
+	ssize_t done;
+	int fd = -1;
+
+	buf = malloc(INPUT_BUFFER_SIZE);
+	if (!tmp || !buf)
+		goto fail;
+	for (;;) {
+		done = read(in->fd, buf, INPUT_BUFFER_SIZE);
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done <= 0)
+			break;
+		if (fwrite(buf, 1, done, tmp) != (size_t)done)
+			goto fail;
+	}
+	if (done < 0 || fflush(tmp) != 0)
+		goto fail;
+	fd = dup(fileno(tmp));
+	if (fd < 0)
+		goto fail;
+	fclose(tmp);
+	free(buf);
+
+	if (in->flags & INPUT_CLOSE)
+		close(in->fd);
+	in->fd = fd;
+	in->flags |= INPUT_CLOSE;
+	return 0;
+
+fail:
+	if (tmp)
+		fclose(tmp);
+	free(buf);
+	return -1;
+}
+
+int input_open(struct input *in, const char *filename, int flags)
+{
+	memset(in, 0, sizeof(*in));
+	in->flags = flags & INPUT_NUL;
+	if (!filename || strcmp(filename, "-") == 0)
+		in->fd = STDIN_FILENO;
+	else {
+		in->fd = open(filename, O_RDONLY);
+		if (in->fd < 0)
+			return -1;
+		in->flags |= INPUT_CLOSE;
+	}
+
+	/* Files which cannot be mapped are read instead. */
+	if (input_map(in) == 0)
+		return 0;
+	if (flags & INPUT_SPOOL) {
+		if (input_spool(in) != 0)
+			goto fail;
+		if (input_map(in) == 0)
+			return 0;
+	}
+	if (high_water_alloc((void **)&in->buf, &in->size,
+			     INPUT_BUFFER_SIZE))
+		goto fail;
+	return 0;
+
+fail:
+	if (in->flags & INPUT_CLOSE)
+		close(in->fd);
+	return -1;
+}
+
+/*
+ * Make room for and read more data. Lines longer than the buffer make
+ * it grow.
+ */
+static int input_fill(struct input *in)
+{
+	ssize_t done;
+
+	if (in->pos) {
+		memmove(in->buf, in->buf + in->pos, in->end - in->pos);
+		in->base += in->pos;
+		in->end -= in->pos;
+		in->scan -= in->pos;
+		in->pos = 0;
+	}
+	if (in->end == in->size &&
+	    high_water_alloc((void **)&in->buf, &in->size, 2 * in->size))
+		return -1;
+	do
+		done = read(in->fd, in->buf + in->end, in->size - in->end);
+	while (done < 0 && errno == EINTR);
+	if (done < 0)
+		return -1;
+	if (done == 0)
+		in->flags |= INPUT_EOF;
+	in->end += done;
+	return 0;
+}
+
+/*
+ * Return the next line without its end-of-line characters. Returns 1 for
+ * a line, 0 at the end of the input, and -1 on errors.
+ */
+int input_next_line(struct input *in, const char **line, size_t *len)
+{
+	int delim = (in->flags & INPUT_NUL) ? '\0' : '\n';
+	char *start, *eol;
+
+	for (;;) {
+		if (in->scan < in->pos)
+			in->scan = in->pos;
+		eol = memchr(in->buf + in->scan, delim, in->end - in->scan);
+		if (eol || (in->flags & INPUT_EOF))
+			break;
+		in->scan = in->end;
+		if (input_fill(in) != 0)
+			return -1;
+	}
+	start = in->buf + in->pos;
+	if (!eol) {
+		if (in->pos == in->end)
+			return 0;
+		eol = in->buf + in->end;
+		in->pos = in->end;
+	} else
+		in->pos = eol - in->buf + 1;
+	while (delim == '\n' && eol > start &&
+	       (eol[-1] == '\r' || eol[-1] == '\n'))
+		eol--;
+	*line = start;
+	*len = eol - start;
+	return 1;
+}
+
+/*
+ * Return the next non-empty line as a '\0'-terminated string in *BUF,
+ * which is grown as needed. Used for reading lists of file names.
+ */
+int input_next_name(struct input *in, char **buf, size_t *size)
+{
+	const char *line;
+	size_t len;
+	int ret;
+
+	do {
+		ret = input_next_line(in, &line, &len);
+		if (ret <= 0)
+			return ret;
+	} while (len == 0);
+	if (high_water_alloc((void **)buf, size, len + 1))
+		return -1;
+	memcpy(*buf, line, len);
+	(*buf)[len] = '\0';
+	return 1;
+}
+
+/*
+ * The number of bytes which can be consumed without reading.
+ */
+size_t input_buffered(const struct input *in)
+{
+	return in->end - in->pos;
+}
+
+off_t input_tell(const struct input *in)
+{
+	return in->base + in->pos;
+}
+
+int input_seek(struct input *in, off_t pos)
+{
+	if (in->flags & INPUT_MMAP) {
+		if (pos < 0 || pos > (off_t)in->end) {
+			errno = EINVAL;
+			return -1;
+		}
+		in->pos = in->scan = pos;
+		return 0;
+	}
+
+	/* Skip forward by reading. */
+	if (pos < in->base + (off_t)in->pos) {
+		errno = ESPIPE;
+		return -1;
+	}
+	while (pos > in->base + (off_t)in->end) {
+		if (in->flags & INPUT_EOF) {
+			errno = EINVAL;
+			return -1;
+		}
+		in->pos = in->scan = in->end;
+		if (input_fill(in) != 0)
+			return -1;
+	}
+	in->pos = in->scan = pos - in->base;
+	return 0;
+}
+
+int input_close(struct input *in)
+{
+	int error = 0;
+
+	if (in->flags & INPUT_MMAP)
+		munmap(in->buf, in->size);
+	else
+		free(in->buf);
+	in->buf = NULL;
+	if ((in->flags & INPUT_CLOSE) && close(in->fd) != 0)
+		error = -1;
+	return error;
+}
@@ -0,0 +1,174 @@
+/*
+  File: name_match.c
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "name_match.h"
+
+#define is_meta(c) \
+	((c) != '\0' && strchr(".[]()*+?{}|^$\\", (c)) != NULL)
+
+/*
+ * Parse one alternative of PATTERN, up to the next '|' or the end of the
+ * pattern. Returns a pointer past the alternative, or NULL if it is not a
+ * plain (optionally anchored) string.
+ */
+static const char *parse_literal(const char *pattern,
+				 struct name_match_literal *lit)
+{
+	const char *p = pattern;
+	char *s;
+
+	lit->anchors = 0;
+	lit->str = s = malloc(strlen(pattern) + 1);
+	if (!s)
+		return NULL;
+
+	if (*p == '^') {
+		lit->anchors |= NAME_MATCH_ANCHOR_START;
+		p++;
+	}
+	while (*p != '\0' && *p != '|') {
+		if (*p == '\\' && is_meta(p[1])) {
+			*s++ = p[1];
+			p += 2;
+		} else if (*p == '$' && (p[1] == '\0' || p[1] == '|')) {
+			lit->anchors |= NAME_MATCH_ANCHOR_END;
+			p++;
+		} else if (!is_meta(*p)) {
+			*s++ = *p++;
+		} else
+			goto fail;
+	}
+	*s = '\0';
+	lit->len = s - lit->str;
+
+	/* Leave empty alternatives to the regex engine. */
+	if (lit->len == 0)
+		goto fail;
+	return p;
+
+fail:
+	free(lit->str);
+	lit->str = NULL;
+	return NULL;
+}
+
+int name_match_compile(struct name_match *match, const char *pattern)
+{
+	const char *p = pattern;
+	size_t n;
+
+	memset(match, 0, sizeof(*match));
+	if (*pattern == '\0') {
+		match->type = NAME_MATCH_ALL;
+		return 0;
+	}
+
+	for (n = 1; *p != '\0'; p++)
+		if (*p == '|')
+			n++;
+	match->literals = calloc(n, sizeof(*match->literals));
+	if (!match->literals)
+		return -1;
+
+	for (p = pattern; ; p++) {
+		struct name_match_literal *lit =
+			&match->literals[match->num_literals];
+
+		p = parse_literal(p, lit);
+		if (!p)
+			break;
+		match->num_literals++;
+		if (*p == '\0') {
+			match->type = NAME_MATCH_LITERAL;
+			return 0;
+		}
+	}
+
+	name_match_free(match);
+	if (regcomp(&match->regex, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	match->type = NAME_MATCH_REGEX;
+	return 0;
+}
+
+static int match_literal(const struct name_match_literal *lit,
+			 const char *name, size_t len)
+{
+	if (len < lit->len)
+		return 0;
+	switch (lit->anchors) {
+		case NAME_MATCH_ANCHOR_START:
+			return memcmp(name, lit->str, lit->len) == 0;
+		case NAME_MATCH_ANCHOR_END:
+			return memcmp(name + len - lit->len, lit->str,
+				      lit->len) == 0;
+		case NAME_MATCH_ANCHOR_START | NAME_MATCH_ANCHOR_END:
+			return len == lit->len &&
+			       memcmp(name, lit->str, len) == 0;
+		default:
+			return memmem(name, len, lit->str, lit->len) != NULL;
+	}
+}
+
+/*
+ * Check whether NAME (of length LEN, not counting the terminating '\0')
+ * matches.
+ */
+int name_match(const struct name_match *match, const char *name, size_t len)
+{
+	size_t n;
+
+	switch (match->type) {
+		case NAME_MATCH_ALL:
+			return 1;
+
+		case NAME_MATCH_LITERAL:
+			for (n = 0; n < match->num_literals; n++) {
+				const struct name_match_literal *lit =
+					&match->literals[n];
+
+				/* Cheap first-character rejection. */
+				if ((lit->anchors & NAME_MATCH_ANCHOR_START) &&
+				    len && *name != *lit->str)
+					continue;
+				if (match_literal(lit, name, len))
+					return 1;
+			}
+			return 0;
+
+		default:
+			return regexec(&match->regex, name, 0, NULL, 0) == 0;
+	}
+}
+
+void name_match_free(struct name_match *match)
+{
+	size_t n;
+
+	if (match->type == NAME_MATCH_REGEX)
+		regfree(&match->regex);
+	for (n = 0; n < match->num_literals; n++)
+		free(match->literals[n].str);
+	free(match->literals);
+	memset(match, 0, sizeof(*match));
+}
@@ -0,0 +1,193 @@
+/*
+  File: output.c
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "output.h"
+
+#define OUTPUT_BUFFER_SIZE	(1 << 20)
+#define OUTPUT_PREALLOC_CHUNK	(64 << 20)
+
+/*
+ * Grow the preallocated area of the output file ahead of the data,
+ * without changing the file size: readers of an incomplete file, for
+ * example after a crash, never see padding. Filesystems which cannot
+ * preallocate simply don't.
+ */
+static void output_reserve(struct output *out, size_t len)
+{
+#ifdef __linux__
+	off_t end = out->written + len;
+
+	if (!(out->flags & OUTPUT_PREALLOC) || end <= out->allocated)
+		return;
+	end = (end + OUTPUT_PREALLOC_CHUNK - 1) &
+	      ~((off_t)OUTPUT_PREALLOC_CHUNK - 1);
+	if (fallocate(out->fd, FALLOC_FL_KEEP_SIZE, out->allocated,
+		      end - out->allocated) != 0) {
+		out->flags &= ~OUTPUT_PREALLOC;
+		return;
+	}
+	out->allocated = end;
+#endif
+}
+
+static int output_writev(struct output *out, struct iovec *iov, int iovcnt)
+{
+	size_t total = 0;
+	int n;
+
+	for (n = 0; n < iovcnt; n++)
+		total += iov[n].iov_len;
+	output_reserve(out, total);
+
+	while (iovcnt) {
+		ssize_t done = writev(out->fd, iov, iovcnt);
+
+		if (done < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		out->written += done;
+		while (iovcnt && (size_t)done >= iov->iov_len) {
+			done -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+	return 0;
+}
+
+int output_open(struct output *out, const char *filename)
+{
+	struct stat st;
+	void *buf;
+
+	memset(out, 0, sizeof(*out));
+	if (!filename || strcmp(filename, "-") == 0)
+		out->fd = STDOUT_FILENO;
+	else {
+		out->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (out->fd < 0)
+			return -1;
+		out->flags |= OUTPUT_CLOSE;
+		if (fstat(out->fd, &st) == 0 && S_ISREG(st.st_mode))
+			out->flags |= OUTPUT_PREALLOC;
+	}
+	if (isatty(out->fd))
+		out->flags |= OUTPUT_TTY;
+
+	if (posix_memalign(&buf, getpagesize(), OUTPUT_BUFFER_SIZE) != 0) {
+		if (out->flags & OUTPUT_CLOSE)
+			close(out->fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	out->buf = buf;
+	out->size = OUTPUT_BUFFER_SIZE;
+	return 0;
+}
+
+int output_flush(struct output *out)
+{
+	struct iovec iov;
+
+	if (out->len == 0)
+		return 0;
+	iov.iov_base = out->buf;
+	iov.iov_len = out->len;
+	out->len = 0;
+	return output_writev(out, &iov, 1);
+}
+
+int output_write(struct output *out, const void *data, size_t len)
+{
+	struct iovec iov[2];
+
+	if (len <= out->size - out->len) {
+		memcpy(out->buf + out->len, data, len);
+		out->len += len;
+		return 0;
+	}
+	if (len < out->size / 2) {
+		if (output_flush(out) != 0)
+			return -1;
+		memcpy(out->buf, data, len);
+		out->len = len;
+		return 0;
+	}
+
+	/* Write large chunks straight from the caller's buffer. */
+	iov[0].iov_base = out->buf;
+	iov[0].iov_len = out->len;
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = len;
+	out->len = 0;
+	return output_writev(out, iov, 2);
+}
+
+int output_puts(struct output *out, const char *str)
+{
+	return output_write(out, str, strlen(str));
+}
+
+/*
+ * Called after each complete record, so that interactive users see
+ * results as they are produced.
+ */
+int output_record_end(struct output *out)
+{
+	if (out->flags & OUTPUT_TTY)
+		return output_flush(out);
+	return 0;
+}
+
+/* Returns -1 with errno set to that of the first error. */
+int output_close(struct output *out)
+{
+	int error = output_flush(out), saved_errno = errno;
+
+	/*
+	 * Give back the space preallocated beyond the end. The size does
+	 * not change; truncating to it releases the blocks past it.
+	 */
+	if ((out->flags & OUTPUT_PREALLOC) && out->allocated > out->written &&
+	    ftruncate(out->fd, out->written) != 0 && !error) {
+		error = -1;
+		saved_errno = errno;
+	}
+	if ((out->flags & OUTPUT_CLOSE) && close(out->fd) != 0 && !error) {
+		error = -1;
+		saved_errno = errno;
+	}
+	free(out->buf);
+	out->buf = NULL;
+	errno = saved_errno;
+	return error;
+}
@@ -19,38 +19,140 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <string.h>
 #include "misc.h"
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#define QUOTE_CHARS_MAX		32
+#define QUOTE_SIMD_CHARS	6
+
+/*
+ * The set of characters to quote, as a 256-bit mask. Callers use a
+ * handful of constant sets, so the mask of the last set is cached.
+ * The backslash and the terminating '\0' are always in the set; the
+ * scanner stops at both.
+ */
+struct quote_map {
+	int valid;
+	char chars[QUOTE_CHARS_MAX + 1];
+	size_t nchars;
+	unsigned char bits[256 / 8];
+#ifdef __SSE2__
+	__m128i vec[QUOTE_SIMD_CHARS];
+#endif
+};
+
+static struct quote_map map;
+
+#define in_map(m, c) \
+	((m)->bits[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+
+static void quote_map_init(const char *quote_chars)
+{
+	size_t len = strlen(quote_chars);
+	const char *c;
+
+	if (map.valid && strcmp(map.chars, quote_chars) == 0)
+		return;
+
+	memset(map.bits, 0, sizeof(map.bits));
+	map.bits['\0' >> 3] |= 1 << ('\0' & 7);
+	map.bits['\\' >> 3] |= 1 << ('\\' & 7);
+	map.nchars = 0;
+	for (c = quote_chars; *c != '\0'; c++) {
+		if (in_map(&map, *c))
+			continue;
+		map.bits[(unsigned char)*c >> 3] |= 1 << ((unsigned char)*c & 7);
+#ifdef __SSE2__
+		if (map.nchars < QUOTE_SIMD_CHARS)
+			map.vec[map.nchars] = _mm_set1_epi8(*c);
+#endif
+		map.nchars++;
+	}
+
+	/* Sets that do not fit the cache are rebuilt on each call. */
+	map.valid = (len <= QUOTE_CHARS_MAX);
+	if (map.valid)
+		strcpy(map.chars, quote_chars);
+}
+
+/*
+ * Return a pointer to the first character in s which needs quoting, or
+ * to the terminating '\0'.
+ */
+static const unsigned char *quote_scan(const unsigned char *s)
+{
+#ifdef __SSE2__
+	if (map.nchars <= QUOTE_SIMD_CHARS) {
+		/*
+		 * Aligned loads never cross a page boundary, so reading
+		 * beyond the end of the string is harmless here.
+		 */
+		const __m128i *p = (const __m128i *)((uintptr_t)s & ~15);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i backslash = _mm_set1_epi8('\\');
+		unsigned int mask = ~0U << ((uintptr_t)s & 15);
+
+		for (;;) {
+			__m128i chunk = _mm_load_si128(p), eq;
+			size_t n;
+
+			eq = _mm_or_si128(_mm_cmpeq_epi8(chunk, zero),
+					  _mm_cmpeq_epi8(chunk, backslash));
+			for (n = 0; n < map.nchars; n++)
+				eq = _mm_or_si128(eq,
+					_mm_cmpeq_epi8(chunk, map.vec[n]));
+			mask &= _mm_movemask_epi8(eq);
+			if (mask)
+				return (const unsigned char *)p +
+				       __builtin_ctz(mask);
+			mask = ~0U;
+			p++;
+		}
+	}
+#endif
+	while (!in_map(&map, *s))
+		s++;
+	return s;
+}
+
 const char *quote(const char *str, const char *quote_chars)
 {
 	static char *quoted_str;
 	static size_t quoted_str_len;
-	const unsigned char *s;
+	const unsigned char *s, *run;
 	char *q;
 	size_t nonpr;
 
 	if (!str)
 		return str;
 
-	for (nonpr = 0, s = (unsigned char *)str; *s != '\0'; s++)
-		if (*s == '\\' || strchr(quote_chars, *s))
-			nonpr++;
-	if (nonpr == 0)
+	quote_map_init(quote_chars);
+	s = quote_scan((const unsigned char *)str);
+	if (*s == '\0')
 		return str;
 
+	for (nonpr = 0; *s != '\0'; s = quote_scan(s + 1))
+		nonpr++;
+
 	if (high_water_alloc((void **)&quoted_str, &quoted_str_len,
 			     (s - (unsigned char *)str) + nonpr * 3 + 1))
 		return NULL;
-	for (s = (unsigned char *)str, q = quoted_str; *s != '\0'; s++) {
-		if (*s == '\\' || strchr(quote_chars, *s)) {
-			*q++ = '\\';
-			*q++ = '0' + ((*s >> 6)    );
-			*q++ = '0' + ((*s >> 3) & 7);
-			*q++ = '0' + ((*s     ) & 7);
-		} else
-			*q++ = *s;
+	for (run = (unsigned char *)str, q = quoted_str; ; run = s + 1) {
+		s = quote_scan(run);
+		memcpy(q, run, s - run);
+		q += s - run;
+		if (*s == '\0')
+			break;
+		*q++ = '\\';
+		*q++ = '0' + ((*s >> 6)    );
+		*q++ = '0' + ((*s >> 3) & 7);
+		*q++ = '0' + ((*s     ) & 7);
 	}
 	*q++ = '\0';
 
@@ -0,0 +1,156 @@
+/*
+  File: rate_limit.c
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "rate_limit.h"
+
+/*
+ * Token buckets shared by all threads of the process. A caller takes what
+ * it needs even if the bucket runs into debt, and then sleeps until the
+ * debt would have been paid off; this keeps the long-term rate exact for
+ * requests of any size. Unused tokens accumulate for at most
+ * RATE_LIMIT_BURST seconds.
+ */
+#define RATE_LIMIT_BURST	0.1  /* seconds */
+
+struct bucket {
+	double rate, tokens, last;
+};
+
+static struct bucket ops_bucket, bytes_bucket;
+static pthread_mutex_t bucket_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Take AMOUNT tokens, and return how long to wait for them. */
+static double take(struct bucket *b, double amount, double t)
+{
+	if (!b->rate)
+		return 0;
+	if (b->last) {
+		b->tokens += (t - b->last) * b->rate;
+		if (b->tokens > b->rate * RATE_LIMIT_BURST)
+			b->tokens = b->rate * RATE_LIMIT_BURST;
+	}
+	b->last = t;
+	b->tokens -= amount;
+	return b->tokens < 0 ? -b->tokens / b->rate : 0;
+}
+
+/*
+ * Limit all callers of rate_limit() together to OPS_PER_SEC operations
+ * and BYTES_PER_SEC bytes per second; 0 means no limit.
+ */
+void rate_limit_set(double ops_per_sec, double bytes_per_sec)
+{
+	pthread_mutex_lock(&bucket_lock);
+	ops_bucket.rate = ops_per_sec;
+	bytes_bucket.rate = bytes_per_sec;
+	pthread_mutex_unlock(&bucket_lock);
+}
+
+/* Account for OPS operations which transfer BYTES bytes. */
+void rate_limit(unsigned int ops, size_t bytes)
+{
+	struct timespec ts;
+	double t, wait, w;
+
+	if (!ops_bucket.rate && !bytes_bucket.rate)
+		return;
+	pthread_mutex_lock(&bucket_lock);
+	t = now();
+	wait = take(&ops_bucket, ops, t);
+	w = take(&bytes_bucket, bytes, t);
+	if (w > wait)
+		wait = w;
+	pthread_mutex_unlock(&bucket_lock);
+
+	if (wait > 0) {
+		ts.tv_sec = wait;
+		ts.tv_nsec = (wait - ts.tv_sec) * 1e9;
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+			;
+	}
+}
+
+/*
+ * Parse a rate, which may be followed by k, M or G for multiples of 1024.
+ */
+int rate_limit_parse(const char *arg, double *rate)
+{
+	char *end;
+
+	if (!isdigit(*arg) && *arg != '.')
+		return -1;
+	*rate = strtod(arg, &end);
+	switch (*end) {
+		case 'k': case 'K':
+			*rate *= 1024;
+			end++;
+			break;
+		case 'm': case 'M':
+			*rate *= 1024 * 1024;
+			end++;
+			break;
+		case 'g': case 'G':
+			*rate *= 1024 * 1024 * 1024;
+			end++;
+			break;
+	}
+	if (*end || !(*rate > 0))
+		return -1;
+	return 0;
+}
+
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+
+/*
+ * Run in the idle I/O scheduling class and with SCHED_IDLE. Both are
+ * inherited by threads created afterwards, so call this early.
+ */
+int rate_limit_idle(void)
+{
+	struct sched_param param = { 0 };
+
+#ifdef SYS_ioprio_set
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+		return -1;
+#endif
+#ifdef SCHED_IDLE
+	if (sched_setscheduler(0, SCHED_IDLE, &param) != 0)
+		return -1;
+#endif
+	return 0;
+}
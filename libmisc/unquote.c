@@ -20,35 +20,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
 #include "misc.h"
 
 char *unquote(char *str)
 {
-	unsigned char *s, *t;
+	unsigned char *s, *t, *run;
+	size_t len;
 
 	if (!str)
 		return str;
 
-	for (s = (unsigned char *)str; *s != '\0'; s++)
-		if (*s == '\\')
-			break;
-	if (*s == '\0')
+	/* Most names and paths contain no escapes at all. */
+	s = (unsigned char *)strchr(str, '\\');
+	if (!s)
 		return str;
 
 #define isoctal(c) \
 	((c) >= '0' && (c) <= '7')
 
 	t = s;
-	do {
-		if (*s == '\\' &&
-		    isoctal(*(s+1)) && isoctal(*(s+2)) && isoctal(*(s+3))) {
+	for (;;) {
+		if (isoctal(*(s+1)) && isoctal(*(s+2)) && isoctal(*(s+3))) {
 			*t++ = ((*(s+1) - '0') << 6) +
 			       ((*(s+2) - '0') << 3) +
 			       ((*(s+3) - '0')     );
-			s += 3;
+			s += 4;
 		} else
-			*t++ = *s;
-	} while (*s++ != '\0');
+			*t++ = *s++;
+
+		/* Move the run up to the next backslash in one go. */
+		run = s;
+		s = (unsigned char *)strchr((char *)run, '\\');
+		len = s ? s - run : strlen((char *)run);
+		s = run + len;
+		if (t != run)
+			memmove(t, run, len);
+		t += len;
+		if (*s == '\0')
+			break;
+	}
+	*t = '\0';
 
 	return str;
 }
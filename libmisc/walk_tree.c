@@ -24,10 +24,13 @@
 #include <sys/resource.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
 #include "walk_tree.h"
+#include "fs_caps.h"
+#include "rate_limit.h"
 
 struct entry_handle {
 	struct entry_handle *prev, *next;
@@ -45,6 +48,138 @@ struct entry_handle head = {
 struct entry_handle *closed = &head;
 unsigned int num_dir_handles;
 
+static double sample_rate = 1;
+static unsigned long long sample_state;
+
+/*
+ * Only visit a random fraction RATE of the entries in each directory; a
+ * directory which is skipped is not descended into. The top-level path
+ * is always visited, so an entry at depth d is visited with probability
+ * RATE^d. The same SEED selects the same entries of an unchanged tree.
+ */
+void walk_tree_sample(double rate, unsigned long long seed)
+{
+	sample_rate = rate;
+	sample_state = seed;
+}
+
+static double walk_tree_random(void)
+{
+	unsigned long long z;
+
+	/* splitmix64 */
+	z = (sample_state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z ^= z >> 31;
+	return (z >> 11) * (1.0 / (1ULL << 53));
+}
+
+static unsigned int shard_index, shard_count, shard_depth;
+static size_t shard_root_len;
+
+/*
+ * Only visit the entries which belong to shard INDEX of COUNT, so that
+ * COUNT walks of the same tree, for example on different machines,
+ * together visit each entry exactly once. Entries are assigned by a hash
+ * of their path below the top-level path; all directories are still read,
+ * but the other entries of other shards are not examined. With DEPTH > 0,
+ * directories at that depth are assigned with everything below them by a
+ * hash of their inode number instead, which does not depend on where the
+ * filesystem is mounted; directories above are read by all shards.
+ * Directories are read in name order, so that the shards can be merged
+ * into the order of a walk with COUNT = 1.
+ */
+void walk_tree_shard(unsigned int index, unsigned int count,
+		     unsigned int depth)
+{
+	shard_index = index;
+	shard_count = count;
+	shard_depth = depth;
+}
+
+static int shard_owns(unsigned long long hash)
+{
+	/* FNV-1a hashes are finalized like in splitmix64. */
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+	hash ^= hash >> 31;
+	return hash % shard_count == shard_index;
+}
+
+static int shard_owns_path(const char *path)
+{
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+
+	for (path += shard_root_len; *path; path++)
+		hash = (hash ^ (unsigned char)*path) * 0x100000001b3ULL;
+	return shard_owns(hash);
+}
+
+struct sorted_name {
+	char *name;
+	unsigned char type;  /* d_type */
+};
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(((const struct sorted_name *)a)->name,
+		      ((const struct sorted_name *)b)->name);
+}
+
+static void free_names(struct sorted_name *names, size_t num)
+{
+	while (num)
+		free(names[--num].name);
+	free(names);
+}
+
+/* Read the entries of a directory, sorted by name. */
+static int read_sorted(DIR *stream, struct sorted_name **names, size_t *num)
+{
+	struct dirent *entry;
+	size_t size = 0;
+
+	*names = NULL;
+	*num = 0;
+	while ((entry = readdir(stream)) != NULL) {
+		if (!strcmp(entry->d_name, ".") ||
+		    !strcmp(entry->d_name, ".."))
+			continue;
+		if (*num == size) {
+			struct sorted_name *n;
+
+			size = size ? 2 * size : 64;
+			n = realloc(*names, size * sizeof(*n));
+			if (!n)
+				goto fail;
+			*names = n;
+		}
+		(*names)[*num].name = strdup(entry->d_name);
+		if (!(*names)[*num].name)
+			goto fail;
+		(*names)[*num].type = entry->d_type;
+		(*num)++;
+	}
+	qsort(*names, *num, sizeof(**names), compare_names);
+	return 0;
+
+fail:
+	free_names(*names, *num);
+	return -1;
+}
+
+/*
+ * Check whether a directory entry of type TYPE may have to be descended
+ * into. Other entries which belong to another shard need not be looked
+ * at at all.
+ */
+static int may_descend(unsigned char type, int walk_flags)
+{
+	return type == DT_DIR || type == DT_UNKNOWN ||
+	       (type == DT_LNK && (walk_flags & WALK_TREE_LOGICAL));
+}
+
 static int walk_tree_visited(dev_t dev, ino_t ino)
 {
 	struct entry_handle *i;
@@ -55,16 +190,22 @@ static int walk_tree_visited(dev_t dev, ino_t ino)
 	return 0;
 }
 
+/*
+ * OWNER is 1 if the entry belongs to this shard, 0 if it does not, and
+ * -1 if this is decided for each entry.
+ */
 static int walk_tree_rec(const char *path, int walk_flags,
 			 int (*func)(const char *, const struct stat *, int,
-				     void *), void *arg, int depth)
+				     void *), void *arg, int depth, int owner)
 {
 	int follow_symlinks = (walk_flags & WALK_TREE_LOGICAL) ||
 			      (!(walk_flags & WALK_TREE_PHYSICAL) &&
 			       depth == 0);
-	int have_dir_stat = 0, flags = walk_flags, err;
+	int have_dir_stat = 0, flags = walk_flags, err = 0, mine = owner;
 	struct entry_handle dir;
 	struct stat st;
+	struct sorted_name *names = NULL;
+	size_t num_names = 0, n = 0;
 
 	/*
 	 * If (walk_flags & WALK_TREE_PHYSICAL), do not traverse symlinks.
@@ -74,16 +215,20 @@ static int walk_tree_rec(const char *path, int walk_flags,
 	if (depth == 0)
 		flags |= WALK_TREE_TOPLEVEL;
 
+	if (owner < 0)
+		mine = shard_owns_path(path);
+
+	rate_limit(1, 0);
 	if (lstat(path, &st) != 0)
-		return func(path, NULL, flags | WALK_TREE_FAILED, arg);
+		return mine ? func(path, NULL, flags | WALK_TREE_FAILED, arg) : 0;
 	if (S_ISLNK(st.st_mode)) {
 		flags |= WALK_TREE_SYMLINK;
 		if ((flags & WALK_TREE_DEREFERENCE) ||
 		    ((flags & WALK_TREE_TOPLEVEL) &&
 		     (flags & WALK_TREE_DEREFERENCE_TOPLEVEL))) {
 			if (stat(path, &st) != 0)
-				return func(path, NULL,
-					    flags | WALK_TREE_FAILED, arg);
+				return mine ? func(path, NULL, flags |
+						   WALK_TREE_FAILED, arg) : 0;
 			dir.dev = st.st_dev;
 			dir.ino = st.st_ino;
 			have_dir_stat = 1;
@@ -93,7 +238,36 @@ static int walk_tree_rec(const char *path, int walk_flags,
 		dir.ino = st.st_ino;
 		have_dir_stat = 1;
 	}
-	err = func(path, &st, flags, arg);
+
+	/*
+	 * With WALK_TREE_FS_CAPS, tell FUNC about filesystems without
+	 * extended attributes. Filesystems are probed when first seen,
+	 * which is usually at a directory; symlinks which were not
+	 * followed may point elsewhere and are not probed. Filesystems
+	 * below the top level can be skipped entirely.
+	 */
+	if (walk_flags & (WALK_TREE_FS_CAPS | WALK_TREE_SKIP_PSEUDO |
+			  WALK_TREE_SKIP_NO_XATTR)) {
+		int caps = fs_caps(st.st_dev,
+				   S_ISLNK(st.st_mode) ? NULL : path);
+
+		if (depth > 0 &&
+		    (((caps & FS_CAPS_PSEUDO) &&
+		      (walk_flags & WALK_TREE_SKIP_PSEUDO)) ||
+		     ((caps & FS_CAPS_NO_XATTR) &&
+		      (walk_flags & WALK_TREE_SKIP_NO_XATTR))))
+			return 0;
+		if (caps & FS_CAPS_NO_XATTR)
+			flags |= WALK_TREE_NO_XATTR;
+	}
+
+	if (owner < 0 && shard_depth && depth == shard_depth &&
+	    S_ISDIR(st.st_mode))
+		owner = mine = shard_owns(st.st_ino);
+	if (mine)
+		err = func(path, &st, flags, arg);
+	if (!owner)
+		return err;
 
 	/*
 	 * Recurse if WALK_TREE_RECURSIVE and the path is:
@@ -139,7 +313,7 @@ close_another_dir:
 			 * PATH may be a symlink to a regular file, or a dead
 			 * symlink which we didn't follow above.
 			 */
-			if (errno != ENOTDIR && errno != ENOENT)
+			if (errno != ENOTDIR && errno != ENOENT && mine)
 				err += func(path, NULL, flags |
 							WALK_TREE_FAILED, arg);
 			return err;
@@ -162,31 +336,62 @@ close_another_dir:
 		dir.next->prev = &dir;
 		num_dir_handles--;
 
-		while ((entry = readdir(dir.stream)) != NULL) {
+		if (shard_count &&
+		    read_sorted(dir.stream, &names, &num_names) != 0) {
+			if (mine)
+				err += func(path, NULL,
+					    flags | WALK_TREE_FAILED, arg);
+			goto remove_dir;
+		}
+
+		for (;;) {
+			const char *name;
+			unsigned char type;
 			char *path_end;
 
-			if (!strcmp(entry->d_name, ".") ||
-			    !strcmp(entry->d_name, ".."))
+			if (names) {
+				if (n == num_names)
+					break;
+				type = names[n].type;
+				name = names[n++].name;
+			} else {
+				entry = readdir(dir.stream);
+				if (!entry)
+					break;
+				name = entry->d_name;
+				if (!strcmp(name, ".") || !strcmp(name, ".."))
+					continue;
+				type = entry->d_type;
+			}
+			if (sample_rate < 1 &&
+			    walk_tree_random() >= sample_rate)
 				continue;
 			path_end = strchr(path, 0);
-			if ((path_end - path) + strlen(entry->d_name) + 1 >=
+			if ((path_end - path) + strlen(name) + 1 >=
 			    FILENAME_MAX) {
 				errno = ENAMETOOLONG;
-				err += func(path, NULL,
-					    flags | WALK_TREE_FAILED, arg);
+				if (mine)
+					err += func(path, NULL, flags |
+						    WALK_TREE_FAILED, arg);
 				continue;
 			}
 			*path_end++ = '/';
-			strcpy(path_end, entry->d_name);
-			err += walk_tree_rec(path, walk_flags, func, arg,
-					     depth + 1);
+			strcpy(path_end, name);
+			if (owner >= 0 || may_descend(type, walk_flags) ||
+			    shard_owns_path(path))
+				err += walk_tree_rec(path, walk_flags, func,
+						     arg, depth + 1, owner);
 			*--path_end = 0;
 			if (!dir.stream) {
 				/* Reopen the directory handle. */
 				dir.stream = opendir(path);
-				if (!dir.stream)
-					return err + func(path, NULL, flags |
-						    WALK_TREE_FAILED, arg);
+				if (!dir.stream) {
+					free_names(names, num_names);
+					if (mine)
+						err += func(path, NULL, flags |
+							WALK_TREE_FAILED, arg);
+					return err;
+				}
 				seekdir(dir.stream, dir.pos);
 
 				closed = closed->next;
@@ -194,13 +399,16 @@ close_another_dir:
 			}
 		}
 
+		free_names(names, num_names);
+
+	remove_dir:
 		/* Remove from the list of handles. */
 		dir.prev->next = dir.next;
 		dir.next->prev = dir.prev;
 		num_dir_handles++;
 
 	skip_dir:
-		if (closedir(dir.stream) != 0)
+		if (closedir(dir.stream) != 0 && mine)
 			err += func(path, NULL, flags | WALK_TREE_FAILED, arg);
 	}
 	return err;
@@ -226,5 +434,7 @@ int walk_tree(const char *path, int walk_flags, unsigned int num,
 		return func(path, NULL, WALK_TREE_FAILED, arg);
 	}
 	strcpy(path_copy, path);
-	return walk_tree_rec(path_copy, walk_flags, func, arg, 0);
+	shard_root_len = strlen(path_copy);
+	return walk_tree_rec(path_copy, walk_flags, func, arg, 0,
+			     shard_count ? -1 : 1);
 }
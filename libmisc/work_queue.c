@@ -0,0 +1,424 @@
+/*
+  File: work_queue.c
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 2.1 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+
+#include "work_queue.h"
+
+struct queue {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty, not_full;
+	void **items;
+	unsigned int size, head, count;
+	int done;
+};
+
+struct worker {
+	struct work_queue *wq;
+	struct queue *queue;
+	pthread_t thread;
+};
+
+/*
+ * With work_queue_adapt(), the number of items processed at the same time
+ * is limited, and the limit is adjusted after each window of items: it
+ * shrinks in proportion to how much the latency per item has grown over
+ * the lowest latency seen, and grows otherwise, doubling until the first
+ * sign of congestion and by its square root after that. It only grows
+ * when it was reached during the window and the last increase paid off
+ * in throughput, and it is kept low enough that items which use CPU time
+ * do not exceed the CPU quota of the cgroup.
+ */
+#define ADAPT_WINDOW		0.1  /* seconds */
+#define ADAPT_MIN_ITEMS		8  /* per window */
+
+struct controller {
+	pthread_mutex_t lock;
+	pthread_cond_t slot;
+	unsigned int min_limit, max_limit, limit, active;
+	int saturated, grew, slow_start;
+	double quota;  /* CPUs, or 0 */
+	double start, latency, cpu, min_latency, throughput;
+	unsigned long items;
+};
+
+struct work_queue {
+	void (*func)(void *, void *);
+	void *arg;
+	unsigned int num_threads, num_started, num_queues;
+	struct worker *workers;
+	struct queue *queues;
+	struct controller *ctl;
+};
+
+static double clock_seconds(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int read_quota(const char *filename, double *quota)
+{
+	char buf[64];
+	double max, period;
+	FILE *f = fopen(filename, "r");
+	int n;
+
+	if (!f)
+		return -1;
+	n = fscanf(f, "%63s %lf", buf, &period);
+	fclose(f);
+	if (n != 2)
+		return -1;
+	max = strtod(buf, NULL);
+	*quota = (strcmp(buf, "max") == 0 || max <= 0 || period <= 0) ?
+		 0 : max / period;
+	return 0;
+}
+
+/* The CPU quota of the cgroup of this process in CPUs, or 0 if none. */
+static double cpu_quota(void)
+{
+	char line[4096], path[4200];
+	double quota = 0, period = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/cgroup", "r");
+	if (f) {
+		while (fgets(line, sizeof(line), f)) {
+			if (strncmp(line, "0::", 3) == 0) {
+				line[strcspn(line, "\n")] = 0;
+				snprintf(path, sizeof(path),
+					 "/sys/fs/cgroup%s/cpu.max", line + 3);
+				if (read_quota(path, &quota) == 0) {
+					fclose(f);
+					return quota;
+				}
+			}
+		}
+		fclose(f);
+	}
+	if (read_quota("/sys/fs/cgroup/cpu.max", &quota) == 0)
+		return quota;
+
+	/* cgroup v1 */
+	f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+	if (f) {
+		if (fscanf(f, "%lf", &quota) != 1)
+			quota = 0;
+		fclose(f);
+	}
+	f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+	if (f) {
+		if (fscanf(f, "%lf", &period) != 1)
+			period = 0;
+		fclose(f);
+	}
+	return (quota > 0 && period > 0) ? quota / period : 0;
+}
+
+/* Called with ctl->lock held at the end of a window. */
+static void adjust_limit(struct controller *ctl, double now)
+{
+	double latency = ctl->latency / ctl->items,
+	       throughput = ctl->items / (now - ctl->start),
+	       gradient, limit;
+
+	/* Let the baseline drift up so that it follows a slower backend. */
+	if (!ctl->min_latency || latency < ctl->min_latency)
+		ctl->min_latency = latency;
+	else
+		ctl->min_latency *= 1.01;
+	gradient = ctl->min_latency / latency;
+	if (gradient < 0.5)
+		gradient = 0.5;
+
+	limit = ctl->limit * gradient;
+	if (gradient > 0.9 && ctl->saturated &&
+	    (!ctl->grew || throughput > ctl->throughput * 1.05))
+		limit += ctl->slow_start ? ctl->limit : sqrt(ctl->limit);
+	else if (gradient <= 0.9 || ctl->grew)
+		ctl->slow_start = 0;
+	if (ctl->quota && ctl->cpu > 0) {
+		double cap = ctl->quota * ctl->latency / ctl->cpu;
+
+		if (limit > cap)
+			limit = cap;
+	}
+	if (limit > ctl->max_limit)
+		limit = ctl->max_limit;
+	if (limit < ctl->min_limit)
+		limit = ctl->min_limit;
+
+	ctl->grew = (unsigned int)limit > ctl->limit;
+	if (ctl->grew)
+		pthread_cond_broadcast(&ctl->slot);
+	ctl->limit = limit;
+	ctl->throughput = throughput;
+	ctl->start = now;
+	ctl->latency = ctl->cpu = 0;
+	ctl->items = 0;
+	ctl->saturated = ctl->active >= ctl->limit;
+}
+
+static void process_item(struct work_queue *wq, void *item)
+{
+	struct controller *ctl = wq->ctl;
+	double start, cpu, now;
+
+	if (!ctl) {
+		wq->func(item, wq->arg);
+		return;
+	}
+
+	pthread_mutex_lock(&ctl->lock);
+	while (ctl->active >= ctl->limit)
+		pthread_cond_wait(&ctl->slot, &ctl->lock);
+	if (++ctl->active >= ctl->limit)
+		ctl->saturated = 1;
+	pthread_mutex_unlock(&ctl->lock);
+
+	start = clock_seconds(CLOCK_MONOTONIC);
+	cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID);
+	wq->func(item, wq->arg);
+	cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID) - cpu;
+	now = clock_seconds(CLOCK_MONOTONIC);
+
+	pthread_mutex_lock(&ctl->lock);
+	ctl->active--;
+	ctl->latency += now - start;
+	ctl->cpu += cpu;
+	ctl->items++;
+	/* A window lasts for a few rounds of items, or ADAPT_WINDOW. */
+	if (ctl->items >= ADAPT_MIN_ITEMS &&
+	    (ctl->items >= 4 * ctl->limit || now - ctl->start >= ADAPT_WINDOW))
+		adjust_limit(ctl, now);
+	if (ctl->active < ctl->limit)
+		pthread_cond_signal(&ctl->slot);
+	pthread_mutex_unlock(&ctl->lock);
+}
+
+static void *worker_main(void *data)
+{
+	struct worker *w = data;
+	struct queue *q = w->queue;
+
+	for (;;) {
+		void *item;
+
+		pthread_mutex_lock(&q->lock);
+		while (q->count == 0 && !q->done)
+			pthread_cond_wait(&q->not_empty, &q->lock);
+		if (q->count == 0) {
+			pthread_mutex_unlock(&q->lock);
+			break;
+		}
+		item = q->items[q->head];
+		q->head = (q->head + 1) % q->size;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+		pthread_mutex_unlock(&q->lock);
+
+		process_item(w->wq, item);
+	}
+	return NULL;
+}
+
+/*
+ * Create a pool of NUM_THREADS threads which call FUNC(item, ARG) for each
+ * item added. With WORK_QUEUE_KEYED, each thread has a queue of QUEUE_SIZE
+ * items of its own; otherwise, all threads share one queue of QUEUE_SIZE
+ * items per thread.
+ */
+struct work_queue *work_queue_create(unsigned int num_threads,
+				     unsigned int queue_size, int flags,
+				     void (*func)(void *, void *), void *arg)
+{
+	struct work_queue *wq;
+	unsigned int n;
+
+	if (num_threads < 1)
+		num_threads = 1;
+	if (queue_size < 1)
+		queue_size = 1;
+	wq = calloc(1, sizeof(*wq));
+	if (!wq)
+		return NULL;
+	wq->func = func;
+	wq->arg = arg;
+	wq->num_threads = num_threads;
+	wq->workers = calloc(num_threads, sizeof(*wq->workers));
+	wq->num_queues = (flags & WORK_QUEUE_KEYED) ? num_threads : 1;
+	wq->queues = calloc(wq->num_queues, sizeof(*wq->queues));
+	if (!wq->workers || !wq->queues)
+		goto fail;
+	if (wq->num_queues == 1)
+		queue_size *= num_threads;
+
+	for (n = 0; n < wq->num_queues; n++) {
+		struct queue *q = &wq->queues[n];
+
+		q->items = malloc(queue_size * sizeof(*q->items));
+		if (!q->items)
+			goto fail;
+		q->size = queue_size;
+		pthread_mutex_init(&q->lock, NULL);
+		pthread_cond_init(&q->not_empty, NULL);
+		pthread_cond_init(&q->not_full, NULL);
+	}
+	for (n = 0; n < num_threads; n++) {
+		struct worker *w = &wq->workers[n];
+
+		w->wq = wq;
+		w->queue = &wq->queues[n % wq->num_queues];
+		errno = pthread_create(&w->thread, NULL, worker_main, w);
+		if (errno)
+			goto fail;
+		wq->num_started++;
+	}
+	return wq;
+
+fail:
+	work_queue_finish(wq);
+	return NULL;
+}
+
+/*
+ * Add ITEM to the queue, and block while the queue is full. For keyed
+ * queues, items with the same KEY are processed by the same thread in
+ * the order in which they were added; otherwise, KEY is ignored.
+ */
+int work_queue_add(struct work_queue *wq, void *item, unsigned long key)
+{
+	struct queue *q = &wq->queues[key % wq->num_queues];
+
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->size)
+		pthread_cond_wait(&q->not_full, &q->lock);
+	q->items[(q->head + q->count) % q->size] = item;
+	q->count++;
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+/*
+ * Adapt the number of items processed at the same time between MIN_THREADS
+ * and the number of threads in the pool. Must be called before any items
+ * are added.
+ */
+int work_queue_adapt(struct work_queue *wq, unsigned int min_threads)
+{
+	struct controller *ctl;
+
+	ctl = calloc(1, sizeof(*ctl));
+	if (!ctl)
+		return -1;
+	pthread_mutex_init(&ctl->lock, NULL);
+	pthread_cond_init(&ctl->slot, NULL);
+	if (min_threads < 1)
+		min_threads = 1;
+	if (min_threads > wq->num_threads)
+		min_threads = wq->num_threads;
+	ctl->min_limit = ctl->limit = min_threads;
+	ctl->slow_start = 1;
+	ctl->max_limit = wq->num_threads;
+	ctl->quota = cpu_quota();
+	ctl->start = clock_seconds(CLOCK_MONOTONIC);
+	wq->ctl = ctl;
+	return 0;
+}
+
+/*
+ * Parse a number of threads, which is either N, MIN-MAX for adapting
+ * between MIN and MAX, or "auto" for adapting between 1 and
+ * WORK_QUEUE_AUTO_MAX. For a fixed number, *MIN is set to 0.
+ */
+int work_queue_parse_threads(const char *arg, unsigned int *min,
+			     unsigned int *max)
+{
+	unsigned long n, m;
+	char *end;
+
+	if (strcmp(arg, "auto") == 0) {
+		*min = 1;
+		*max = WORK_QUEUE_AUTO_MAX;
+		return 0;
+	}
+	if (!isdigit(*arg))
+		return -1;
+	n = strtoul(arg, &end, 10);
+	m = n;
+	if (*end == '-') {
+		if (!isdigit(*++end))
+			return -1;
+		m = strtoul(end, &end, 10);
+	}
+	if (*end || n < 1 || m < n || m > 4096)
+		return -1;
+	*min = (m > n) ? n : 0;
+	*max = m;
+	return 0;
+}
+
+/*
+ * Wait until all queued items have been processed, and free the queue.
+ */
+void work_queue_finish(struct work_queue *wq)
+{
+	unsigned int n;
+
+	for (n = 0; n < wq->num_queues && wq->queues; n++) {
+		struct queue *q = &wq->queues[n];
+
+		if (!q->items)
+			continue;
+		pthread_mutex_lock(&q->lock);
+		q->done = 1;
+		pthread_cond_broadcast(&q->not_empty);
+		pthread_mutex_unlock(&q->lock);
+	}
+	for (n = 0; n < wq->num_started; n++)
+		pthread_join(wq->workers[n].thread, NULL);
+	for (n = 0; n < wq->num_queues && wq->queues; n++) {
+		struct queue *q = &wq->queues[n];
+
+		if (!q->items)
+			continue;
+		pthread_mutex_destroy(&q->lock);
+		pthread_cond_destroy(&q->not_empty);
+		pthread_cond_destroy(&q->not_full);
+		free(q->items);
+	}
+	free(wq->queues);
+	free(wq->workers);
+	if (wq->ctl) {
+		pthread_mutex_destroy(&wq->ctl->lock);
+		pthread_cond_destroy(&wq->ctl->slot);
+		free(wq->ctl);
+	}
+	free(wq);
+}
@@ -26,21 +26,52 @@
 #include <getopt.h>
 #include <locale.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <attr/xattr.h>
 #include "config.h"
 #include "misc.h"
+#include "input.h"
+#include "output.h"
+#include "work_queue.h"
+#include "walk_tree.h"
+#include "name_match.h"
+#include "rate_limit.h"
 
-#define CMD_LINE_OPTIONS "n:x:v:h"
-#define CMD_LINE_SPEC1 "{-n name} [-v value] [-h] file..."
-#define CMD_LINE_SPEC2 "{-x name} [-h] file..."
+#define CMD_LINE_OPTIONS "n:x:v:hRLP0"
+#define CMD_LINE_SPEC1 "{-n name} [-v value] [-hRLP] file..."
+#define CMD_LINE_SPEC2 "{-x name} [-hRLP] file..."
+#define CMD_LINE_SPEC3 "[--remove-matching=regex] [--rename=old:new]... " \
+		       "[-hRLP] file..."
 
 struct option long_options[] = {
 	{ "name",		1, 0, 'n' }, 
 	{ "remove",		1, 0, 'x' },
 	{ "value",		1, 0, 'v' },
 	{ "no-dereference",	0, 0, 'h' },
+	{ "recursive",		0, 0, 'R' },
+	{ "logical",		0, 0, 'L' },
+	{ "physical",		0, 0, 'P' },
 	{ "restore",		1, 0, 'B' },
+	{ "jobs",		1, 0, 'j' },
+	{ "incremental",	0, 0, 'I' },
+	{ "prune",		0, 0, 'X' },
+	{ "inode-order",	0, 0, 'S' },
+	{ "journal",		1, 0, 'J' },
+	{ "resume",		0, 0, 'r' },
+	{ "batch",		0, 0, 'b' },
+	{ "null",		0, 0, '0' },
+	{ "files-from",		1, 0, 'F' },
+	{ "remove-matching",	1, 0, 'M' },
+	{ "rename",		1, 0, 'N' },
+	{ "max-ops-per-sec",	1, 0, 'o' },
+	{ "max-bytes-per-sec",	1, 0, 'w' },
+	{ "idle",		0, 0, 'i' },
 	{ "version",		0, 0, 'V' },
 	{ "help",		0, 0, 'H' },
 	{ NULL,			0, 0, 0 }
@@ -52,122 +83,1284 @@ int opt_set;  /* set an attribute */
 int opt_remove;  /* remove an attribute */
 int opt_restore;  /* restore has been run */
 int opt_deref = 1;  /* dereference symbolic links */
+int walk_flags = WALK_TREE_DEREFERENCE;  /* for -R */
+int opt_jobs = 1;  /* number of worker threads */
+unsigned int opt_min_jobs;  /* adapt between this and opt_jobs, or 0 */
+double opt_max_ops, opt_max_bytes;  /* per second, or 0 */
+int opt_incremental;  /* only restore attributes which differ */
+int opt_prune;  /* remove attributes which are not in the dump */
+int opt_inode_order;  /* restore in inode order */
+const char *opt_journal;  /* journal of applied records */
+int opt_resume;  /* skip records in the journal */
+int opt_batch;  /* read commands from standard input */
+int opt_null;  /* batch fields and file names are terminated by '\0' */
+const char *opt_files_from;  /* read file names from file */
+const char *opt_remove_matching;  /* remove attributes matching regex */
+struct name_match remove_matcher;
+
+struct rename {
+	const char *from, *to;
+};
+struct rename *renames;  /* attributes to rename */
+int num_renames;
+
+#define RESTORE_QUEUE_SIZE	64  /* records queued per restore thread */
+#define WALK_QUEUE_SIZE		256  /* paths queued per -R thread */
+#define RESTORE_SORT_KEYS	(1 << 20)  /* records sorted in memory */
+#define RESTORE_STAT_CHUNK	256  /* paths resolved per work item */
+#define RESTORE_STAT_THREADS	8  /* minimum threads resolving paths */
+#define JOURNAL_SYNC_INTERVAL	5  /* seconds between journal syncs */
 
 int had_errors;
 const char *progname;
 
-int do_set(const char *path, const char *name, const char *value);
-const char *decode(const char *value, size_t *size);
-int restore(const char *filename);
-int hex_digit(char c);
-int base64_digit(char c);
+int do_set(const char *path, const char *name, const void *value,
+	   size_t size);
+int do_set_files(char *paths[], int num_paths, const char *files_from,
+		 const char *name, const void *value, size_t size);
+const char *decode(const char *value, size_t *size);
+int restore(const char *filename);
+int batch(void);
+
+const char *strerror_ea(int err)
+{
+#ifdef __linux__
+	/* The Linux kernel does not define ENOATTR, but maps it to ENODATA. */
+	if (err == ENODATA)
+		return _("No such attribute");
+#endif
+	return strerror(err);
+}
+
+static const char *xquote(const char *str, const char *quote_chars)
+{
+	const char *q = quote(str, quote_chars);
+	if (q == NULL) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		exit(1);
+	}
+	return q;
+}
+
+int do_setxattr(const char *path, const char *name,
+		const void *value, size_t size)
+{
+	return (opt_deref ? setxattr : lsetxattr)(path, name, value, size, 0);
+}
+
+int do_removexattr(const char *path, const char *name)
+{
+	return (opt_deref ? removexattr : lremovexattr)(path, name);
+}
+
+/*
+ * Open PATH for the *xattrat() calls with an empty path.
+ */
+static int open_path(const char *path)
+{
+#ifdef O_PATH
+	return open(path, O_PATH | (opt_deref ? 0 : O_NOFOLLOW));
+#else
+	return open(path, O_RDONLY | O_NONBLOCK | (opt_deref ? 0 : O_NOFOLLOW));
+#endif
+}
+
+/*
+ * Create a pool of THREADS threads, which with --jobs=min-max or
+ * --jobs=auto adapts how many of them are busy at the same time.
+ */
+static struct work_queue *create_queue(unsigned int threads,
+				       unsigned int queue_size, int flags,
+				       void (*func)(void *, void *), void *arg)
+{
+	struct work_queue *wq;
+
+	wq = work_queue_create(threads, queue_size, flags, func, arg);
+	if (wq && opt_min_jobs && work_queue_adapt(wq, opt_min_jobs) != 0) {
+		work_queue_finish(wq);
+		return NULL;
+	}
+	return wq;
+}
+
+/*
+ * Restore works on one "# file:" record at a time. Values are decoded
+ * while parsing, so that applying a record only involves system calls;
+ * with --jobs, records are applied by a pool of threads.
+ */
+struct restore_attr {
+	char *name;
+	char *value;
+	size_t size;
+	int line;
+};
+
+struct restore_record {
+	char *path;
+	int line;
+	off_t offset, end;  /* of the record in the input */
+	int end_line;
+	struct restore_attr *attrs;
+	size_t num_attrs, attrs_size;
+};
+
+const char *restore_filename;
+pthread_mutex_t error_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_record(struct restore_record *rec)
+{
+	size_t n;
+
+	for (n = 0; n < rec->num_attrs; n++) {
+		free(rec->attrs[n].name);
+		free(rec->attrs[n].value);
+	}
+	free(rec->attrs);
+	free(rec->path);
+	free(rec);
+}
+
+/*
+ * Add an attribute to REC. NAME and VALUE point into the input and are
+ * not '\0'-terminated; values are decoded straight into their final
+ * buffer.
+ */
+static int add_attr(struct restore_record *rec, const char *name,
+		    size_t name_len, const char *value, size_t value_len,
+		    int line)
+{
+	struct restore_attr *attr;
+	ssize_t size = 0;
+	char *decoded = NULL;
+
+	if (value) {
+		decoded = malloc(value_len ? value_len : 1);
+		if (!decoded)
+			return -1;
+		size = decode_value(value, value_len, decoded);
+		if (size < 0) {
+			fprintf(stderr, "bad input encoding\n");
+			had_errors++;
+			free(decoded);
+			return 0;  /* skip */
+		}
+	}
+	if (high_water_alloc((void **)&rec->attrs, &rec->attrs_size,
+			     (rec->num_attrs + 1) * sizeof(*rec->attrs)))
+		goto fail;
+	attr = &rec->attrs[rec->num_attrs];
+	attr->name = strndup(name, name_len);
+	if (!attr->name)
+		goto fail;
+	unquote(attr->name);
+	attr->value = decoded;
+	attr->size = size;
+	attr->line = line;
+	rec->num_attrs++;
+	return 0;
+
+fail:
+	free(decoded);
+	return -1;
+}
+
+static void read_error(void)
+{
+	fprintf(stderr, "%s: %s: %s\n", progname, restore_filename,
+		strerror(errno));
+}
+
+/*
+ * Read up to and including the "# file:" line of the next record.
+ * Returns 1 for a record, 0 at the end of the input, and -1 on errors.
+ */
+static int read_header(struct input *in, const char *filename, int *line,
+		       char **path)
+{
+	int backup_line = *line, ret;
+	const char *l;
+	size_t len;
+
+	while ((ret = input_next_line(in, &l, &len)) > 0 && len == 0)
+		(*line)++;
+	if (ret <= 0) {
+		if (ret < 0)
+			read_error();
+		return ret;
+	}
+	(*line)++;
+	if (len < 8 || memcmp(l, "# file: ", 8) != 0) {
+		if (filename) {
+			fprintf(stderr, _("%s: %s: No filename found "
+			                  "in line %d, aborting\n"),
+				progname, filename, backup_line);
+		} else {
+			fprintf(stderr, _("%s: No filename found in "
+		                          "line %d of standard input, "
+					  "aborting\n"),
+				  progname, backup_line);
+		}
+		return -1;
+	}
+
+	*path = strndup(l + 8, len - 8);
+	if (!*path) {
+		perror(progname);
+		return -1;
+	}
+	unquote(*path);
+	return 1;
+}
+
+/*
+ * Read the next record. Returns 1 for a record, 0 at the end of the
+ * input, and -1 on errors.
+ */
+static int read_record(struct input *in, const char *filename, int *line,
+		       struct restore_record **recp)
+{
+	struct restore_record *rec;
+	off_t offset = input_tell(in);
+	char *path;
+	const char *l;
+	size_t len;
+	int ret;
+
+	ret = read_header(in, filename, line, &path);
+	if (ret <= 0)
+		return ret;
+	rec = calloc(1, sizeof(*rec));
+	if (!rec) {
+		free(path);
+		goto nomem;
+	}
+	rec->line = *line;
+	rec->path = path;
+	rec->offset = offset;
+
+	while ((ret = input_next_line(in, &l, &len)) > 0 && len != 0) {
+		const char *value = memchr(l, '=', len);
+		size_t name_len = value ? (size_t)(value - l) : len;
+
+		(*line)++;
+		if (*l == '#')  /* comment, like "# hard link to:" */
+			continue;
+		if (value)
+			value++;
+		if (add_attr(rec, l, name_len, value,
+			     value ? len - name_len - 1 : 0, *line))
+			goto nomem;
+	}
+	if (ret > 0)
+		(*line)++;
+	else if (ret < 0) {
+		read_error();
+		free_record(rec);
+		return -1;
+	}
+	rec->end = input_tell(in);
+	rec->end_line = *line;
+	*recp = rec;
+	return 1;
+
+nomem:
+	perror(progname);
+	if (rec)
+		free_record(rec);
+	return -1;
+}
+
+/*
+ * Skip over the attributes of a record.
+ */
+static int skip_attrs(struct input *in, int *line)
+{
+	const char *l;
+	size_t len;
+	int ret;
+
+	while ((ret = input_next_line(in, &l, &len)) > 0 && len != 0)
+		(*line)++;
+	if (ret > 0)
+		(*line)++;
+	else if (ret < 0) {
+		read_error();
+		return -1;
+	}
+	return 0;
+}
+
+static void restore_error(const struct restore_record *rec, int line)
+{
+	int err = errno;
+
+	pthread_mutex_lock(&error_lock);
+	if (opt_jobs > 1) {
+		/* Errors arrive out of order; tell where they belong. */
+		fprintf(stderr, "%s: %s:%d: %s: %s\n",
+			progname, restore_filename, line,
+			xquote(rec->path, "\n\r"), strerror_ea(err));
+	} else {
+		fprintf(stderr, "%s: %s: %s\n",
+			progname, xquote(rec->path, "\n\r"), strerror_ea(err));
+	}
+	had_errors++;
+	pthread_mutex_unlock(&error_lock);
+}
+
+/*
+ * The apply functions return 0 when the whole record was applied, and -1
+ * after reporting errors.
+ */
+static int apply_record_plain(struct restore_record *rec)
+{
+	size_t n;
+	int status = 0;
+
+	for (n = 0; n < rec->num_attrs; n++) {
+		struct restore_attr *attr = &rec->attrs[n];
+
+		if (do_setxattr(rec->path, attr->name, attr->value,
+				attr->size) < 0) {
+			restore_error(rec, attr->line);
+			status = -1;
+		}
+	}
+	return status;
+}
+
+static int record_has_attr(const struct restore_record *rec, const char *name)
+{
+	size_t n;
+
+	for (n = 0; n < rec->num_attrs; n++)
+		if (strcmp(rec->attrs[n].name, name) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * Only names in namespaces which occur in the record are pruned: a dump
+ * of the user namespace must not remove security labels or ACLs.
+ */
+static int record_has_namespace(const struct restore_record *rec,
+				const char *name)
+{
+	const char *dot = strchr(name, '.');
+	size_t n, len = dot ? dot - name + 1 : strlen(name);
+
+	for (n = 0; n < rec->num_attrs; n++)
+		if (strncmp(rec->attrs[n].name, name, len) == 0)
+			return 1;
+	return 0;
+}
+
+static char *snapshot_names(int dirfd, const char *path, int at_flags,
+			    ssize_t *size)
+{
+	size_t list_size = 256;  /* enough for most files */
+	char *list = NULL, *l;
+
+	for (;;) {
+		l = realloc(list, list_size + 1);
+		if (!l)
+			break;
+		list = l;
+		*size = attr_listxattrat(dirfd, path, at_flags, list,
+					 list_size);
+		if (*size >= 0)
+			return list;
+		if (errno != ERANGE)
+			break;
+		*size = attr_listxattrat(dirfd, path, at_flags, NULL, 0);
+		if (*size < 0)
+			break;
+		list_size = *size;
+	}
+	free(list);
+	return NULL;
+}
+
+static int list_has_name(const char *list, ssize_t size, const char *name)
+{
+	const char *l;
+
+	for (l = list; l < list + size; l += strlen(l) + 1)
+		if (strcmp(l, name) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * Open the file once, take a snapshot of its attribute names, and only
+ * write values which differ from the dump. Unchanged files see no
+ * modifications at all, so their ctime is left alone.
+ */
+static int apply_record_incremental(struct restore_record *rec)
+{
+	char *list = NULL, *value = NULL;
+	ssize_t list_size, ret;
+	size_t n, max_size = 0;
+	int fd, status = -1;
+
+	fd = open_path(rec->path);
+	if (fd < 0) {
+		restore_error(rec, rec->line);
+		return -1;
+	}
+	list = snapshot_names(fd, "", AT_EMPTY_PATH, &list_size);
+	if (!list) {
+		restore_error(rec, rec->line);
+		goto out;
+	}
+	for (n = 0; n < rec->num_attrs; n++)
+		if (rec->attrs[n].size > max_size)
+			max_size = rec->attrs[n].size;
+	value = malloc(max_size + 1);
+	if (!value) {
+		restore_error(rec, rec->line);
+		goto out;
+	}
+
+	status = 0;
+	for (n = 0; n < rec->num_attrs; n++) {
+		struct restore_attr *attr = &rec->attrs[n];
+
+		if (list_has_name(list, list_size, attr->name)) {
+			/* A larger value fails with ERANGE. */
+			ret = attr_getxattrat(fd, "", AT_EMPTY_PATH, attr->name,
+					      value, attr->size);
+			if (ret == (ssize_t)attr->size &&
+			    (attr->size == 0 ||
+			     memcmp(value, attr->value, attr->size) == 0))
+				continue;
+		}
+		if (attr_setxattrat(fd, "", AT_EMPTY_PATH, attr->name,
+				    attr->value, attr->size, 0) < 0) {
+			restore_error(rec, attr->line);
+			status = -1;
+		}
+	}
+
+	if (opt_prune) {
+		const char *l;
+
+		for (l = list; l < list + list_size; l += strlen(l) + 1) {
+			if (record_has_attr(rec, l) ||
+			    !record_has_namespace(rec, l))
+				continue;
+			if (attr_removexattrat(fd, "", AT_EMPTY_PATH, l) < 0 &&
+			    errno != ENODATA) {
+				restore_error(rec, rec->line);
+				status = -1;
+			}
+		}
+	}
+
+out:
+	free(value);
+	free(list);
+	close(fd);
+	return status;
+}
+
+/*
+ * The journal starts with a line "# size mtime nsec" which identifies
+ * the input, followed by a line "start end line" for each record which
+ * has been applied without errors: the offsets of the record in the
+ * input, and the line number at its end. Records are logged in the order
+ * in which they complete, which with --jobs and --inode-order is not the
+ * input order. On --resume, restore refuses an input which does not
+ * match the journal, seeks past the longest run of applied records at
+ * the start of the input, and skips the remaining applied records.
+ * Records which failed are not logged, so they are retried.
+ */
+struct journal_entry {
+	off_t start, end;
+	int line;
+};
+
+/* Identifies the input; not available for pipes. */
+struct journal_input {
+	long long size, mtime;
+	long nsec;
+};
+
+FILE *journal;
+pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+time_t journal_synced;
+struct journal_entry *journal_done;
+size_t num_journal_done;
+
+static int compare_journal_entries(const void *a, const void *b)
+{
+	const struct journal_entry *e1 = a, *e2 = b;
+
+	if (e1->start != e2->start)
+		return e1->start < e2->start ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Returns 1 when the journal exists and describes INPUT, 0 when there is
+ * no journal yet, and -1 otherwise.
+ */
+static int load_journal(const char *filename,
+			const struct journal_input *input)
+{
+	struct journal_entry *done = NULL;
+	struct journal_input logged;
+	size_t size = 0, num = 0;
+	long long start, end;
+	int line;
+	FILE *file;
+
+	file = fopen(filename, "r");
+	if (!file)
+		return errno == ENOENT ? 0 : -1;
+	if (fscanf(file, "# %lld %lld %ld\n", &logged.size, &logged.mtime,
+		   &logged.nsec) != 3 ||
+	    logged.size != input->size || logged.mtime != input->mtime ||
+	    logged.nsec != input->nsec) {
+		fclose(file);
+		errno = 0;
+		return -1;
+	}
+	/* A partially written last line is ignored. */
+	while (fscanf(file, "%lld %lld %d\n", &start, &end, &line) == 3) {
+		if (high_water_alloc((void **)&done, &size,
+				     (num + 1) * sizeof(*done))) {
+			fclose(file);
+			free(done);
+			return -1;
+		}
+		done[num].start = start;
+		done[num].end = end;
+		done[num].line = line;
+		num++;
+	}
+	fclose(file);
+	qsort(done, num, sizeof(*done), compare_journal_entries);
+	journal_done = done;
+	num_journal_done = num;
+	return 1;
+}
+
+static int journal_has(off_t start)
+{
+	struct journal_entry key = { .start = start };
+
+	return num_journal_done &&
+	       bsearch(&key, journal_done, num_journal_done,
+		       sizeof(*journal_done), compare_journal_entries);
+}
+
+/*
+ * Find where to continue: the end of the longest run of applied records
+ * at the start of the input.
+ */
+static off_t journal_resume_point(int *line)
+{
+	off_t pos = 0;
+	size_t n;
+
+	*line = 0;
+	for (n = 0; n < num_journal_done; n++) {
+		if (journal_done[n].start > pos)
+			break;
+		if (journal_done[n].end > pos) {
+			pos = journal_done[n].end;
+			*line = journal_done[n].line;
+		}
+	}
+	return pos;
+}
+
+/*
+ * Identify the input by size and modification time. Pipes cannot be
+ * identified, and are all the same.
+ */
+static int journal_input(const char *filename, struct journal_input *input)
+{
+	struct stat st;
+
+	memset(input, 0, sizeof(*input));
+	if (strcmp(filename, "-") == 0 ? fstat(STDIN_FILENO, &st) :
+					 stat(filename, &st))
+		return -1;
+	if (S_ISREG(st.st_mode)) {
+		input->size = st.st_size;
+		input->mtime = st.st_mtim.tv_sec;
+		input->nsec = st.st_mtim.tv_nsec;
+	} else
+		input->size = -1;
+	return 0;
+}
+
+/*
+ * Returns -1 with errno set on errors, and -1 with errno 0 when the journal
+ * to resume from does not describe the input.
+ */
+static int open_journal(const char *filename, const char *input_filename)
+{
+	struct journal_input input;
+	int ret = 0;
+
+	if (journal_input(input_filename, &input) != 0)
+		return -1;
+	if (opt_resume) {
+		ret = load_journal(filename, &input);
+		if (ret < 0)
+			return -1;
+	}
+	journal = fopen(filename, ret ? "a" : "w");
+	if (!journal)
+		return -1;
+	if (!ret)
+		fprintf(journal, "# %lld %lld %ld\n", input.size, input.mtime,
+			input.nsec);
+	journal_synced = time(NULL);
+	return 0;
+}
+
+static void sync_journal(void)
+{
+	if (fflush(journal) != 0 || fsync(fileno(journal)) != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, opt_journal,
+			strerror(errno));
+		had_errors++;
+	}
+	journal_synced = time(NULL);
+}
+
+static void journal_record(const struct restore_record *rec)
+{
+	pthread_mutex_lock(&journal_lock);
+	fprintf(journal, "%lld %lld %d\n", (long long)rec->offset,
+		(long long)rec->end, rec->end_line);
+	if (time(NULL) - journal_synced >= JOURNAL_SYNC_INTERVAL)
+		sync_journal();
+	pthread_mutex_unlock(&journal_lock);
+}
+
+static void close_journal(void)
+{
+	sync_journal();
+	if (fclose(journal) != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, opt_journal,
+			strerror(errno));
+		had_errors++;
+	}
+	journal = NULL;
+}
+
+static void apply_record(void *item, void *unused)
+{
+	struct restore_record *rec = item;
+	size_t n, bytes = 0;
+	int status;
+
+	/* Charge the record up front; each attribute is one operation. */
+	for (n = 0; n < rec->num_attrs; n++)
+		bytes += rec->attrs[n].size;
+	rate_limit(rec->num_attrs ? rec->num_attrs : 1, bytes);
+	if (opt_incremental)
+		status = apply_record_incremental(rec);
+	else
+		status = apply_record_plain(rec);
+	if (journal && status == 0)
+		journal_record(rec);
+	free_record(rec);
+}
+
+static unsigned long path_hash(const char *path)
+{
+	unsigned long hash = 5381;
+
+	while (*path)
+		hash = hash * 33 + (unsigned char)*path++;
+	return hash;
+}
+
+static void dispatch_record(struct work_queue *wq,
+			    struct restore_record *rec)
+{
+	/*
+	 * Records of the same file always go to the same thread, so that
+	 * they are applied in the order of the input.
+	 */
+	if (wq)
+		work_queue_add(wq, rec, path_hash(rec->path));
+	else
+		apply_record(rec, NULL);
+}
+
+/*
+ * With --inode-order, the input is scanned first and the path of each
+ * record is resolved to an inode. The records are then sorted by device
+ * and inode number and applied in that order, which avoids random inode
+ * table writes on rotating storage. Keys which do not fit in memory are
+ * sorted in runs which go to temporary files, and then merged.
+ */
+struct restore_key {
+	dev_t dev;
+	ino_t ino;
+	off_t offset;  /* of the record in the input */
+	int line;  /* line number before the record */
+	char *path;  /* only while resolving */
+};
+
+struct resolve_chunk {
+	struct restore_key *keys;
+	size_t count;
+};
+
+static void resolve_keys(void *item, void *unused)
+{
+	struct resolve_chunk *chunk = item;
+	size_t n;
+
+	for (n = 0; n < chunk->count; n++) {
+		struct restore_key *key = &chunk->keys[n];
+#ifdef STATX_INO
+		struct statx stx;
+
+		if (statx(AT_FDCWD, key->path, AT_STATX_DONT_SYNC |
+			  (opt_deref ? 0 : AT_SYMLINK_NOFOLLOW),
+			  STATX_INO, &stx) == 0) {
+			key->dev = makedev(stx.stx_dev_major,
+					   stx.stx_dev_minor);
+			key->ino = stx.stx_ino;
+		}
+#else
+		struct stat st;
+
+		if ((opt_deref ? stat : lstat)(key->path, &st) == 0) {
+			key->dev = st.st_dev;
+			key->ino = st.st_ino;
+		}
+#endif
+		else {
+			/* Sort last; applying the record reports the error. */
+			key->dev = (dev_t)-1;
+			key->ino = (ino_t)-1;
+		}
+		free(key->path);
+		key->path = NULL;
+	}
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+	const struct restore_key *k1 = a, *k2 = b;
+
+	if (k1->dev != k2->dev)
+		return k1->dev < k2->dev ? -1 : 1;
+	if (k1->ino != k2->ino)
+		return k1->ino < k2->ino ? -1 : 1;
+	/* Keep the input order for the same inode. */
+	if (k1->offset != k2->offset)
+		return k1->offset < k2->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Resolve the paths of a batch of keys in parallel, and sort them.
+ */
+static int sort_keys(struct restore_key *keys, size_t num_keys)
+{
+	struct resolve_chunk *chunks;
+	struct work_queue *wq;
+	size_t num_chunks = (num_keys + RESTORE_STAT_CHUNK - 1) /
+			    RESTORE_STAT_CHUNK, n;
+	int threads = opt_jobs > RESTORE_STAT_THREADS ?
+		      opt_jobs : RESTORE_STAT_THREADS;
+
+	chunks = malloc((num_chunks ? num_chunks : 1) * sizeof(*chunks));
+	if (!chunks)
+		return -1;
+	wq = create_queue(threads, RESTORE_QUEUE_SIZE, 0, resolve_keys, NULL);
+	if (!wq) {
+		free(chunks);
+		return -1;
+	}
+	for (n = 0; n < num_chunks; n++) {
+		chunks[n].keys = keys + n * RESTORE_STAT_CHUNK;
+		chunks[n].count = n + 1 < num_chunks ? RESTORE_STAT_CHUNK :
+				  num_keys - n * RESTORE_STAT_CHUNK;
+		work_queue_add(wq, &chunks[n], 0);
+	}
+	work_queue_finish(wq);
+	free(chunks);
+
+	qsort(keys, num_keys, sizeof(*keys), compare_keys);
+	return 0;
+}
+
+struct restore_run {
+	FILE *file;
+	struct restore_key key;
+	int valid;
+};
+
+static int write_run(struct restore_run **runs, size_t *num_runs,
+		     struct restore_key *keys, size_t num_keys)
+{
+	struct restore_run *r;
+	FILE *file;
+
+	r = realloc(*runs, (*num_runs + 1) * sizeof(*r));
+	if (!r)
+		return -1;
+	*runs = r;
+	file = tmpfile();
+	if (!file)
+		return -1;
+	if (fwrite(keys, sizeof(*keys), num_keys, file) != num_keys ||
+	    fflush(file) != 0) {
+		fclose(file);
+		return -1;
+	}
+	rewind(file);
+	r[*num_runs].file = file;
+	r[*num_runs].valid = 0;
+	(*num_runs)++;
+	return 0;
+}
+
+static int next_key(struct restore_run *run)
+{
+	run->valid = fread(&run->key, sizeof(run->key), 1, run->file) == 1;
+	return run->valid;
+}
+
+static int apply_key(struct input *in, const char *filename,
+		     struct restore_key *key, struct work_queue *wq)
+{
+	struct restore_record *rec;
+	int line = key->line;
+
+	if (input_seek(in, key->offset) != 0 ||
+	    read_record(in, filename, &line, &rec) <= 0)
+		return -1;
+	dispatch_record(wq, rec);
+	return 0;
+}
+
+static int restore_sorted(struct input *in, const char *filename,
+			  int line, struct work_queue *wq)
+{
+	struct restore_run *runs = NULL;
+	struct restore_key *keys = NULL, *key;
+	size_t keys_size = 0, num_keys = 0, num_runs = 0, n;
+	int status = 0, ret;
+
+	/* Collect, resolve and sort the keys; nothing is applied yet. */
+	for (;;) {
+		off_t offset = input_tell(in);
+		int backup_line = line;
+		char *path;
+
+		/* Small dumps only need a small array. */
+		if (num_keys == keys_size / sizeof(*keys)) {
+			size_t max_keys = num_keys ? 2 * num_keys : 1024;
+
+			if (max_keys > RESTORE_SORT_KEYS)
+				max_keys = RESTORE_SORT_KEYS;
+			if (high_water_alloc((void **)&keys, &keys_size,
+					     max_keys * sizeof(*keys)))
+				goto nomem;
+		}
+		key = &keys[num_keys];
+
+		ret = read_header(in, filename, &line, &path);
+		if (ret <= 0)
+			break;
+		if (skip_attrs(in, &line) != 0) {
+			free(path);
+			ret = -1;
+			break;
+		}
+		if (journal_has(offset)) {
+			free(path);
+			continue;
+		}
+		key->offset = offset;
+		key->line = backup_line;
+		key->path = path;
+		num_keys++;
+		if (num_keys == RESTORE_SORT_KEYS) {
+			if (sort_keys(keys, num_keys) != 0 ||
+			    write_run(&runs, &num_runs, keys, num_keys) != 0)
+				goto nomem;
+			num_keys = 0;
+		}
+	}
+	if (ret < 0) {
+		for (n = 0; n < num_keys; n++)
+			free(keys[n].path);
+		status = 1;
+		goto cleanup;
+	}
+	if (sort_keys(keys, num_keys) != 0)
+		goto nomem;
+
+	if (num_runs == 0) {
+		for (n = 0; n < num_keys; n++)
+			if (apply_key(in, filename, &keys[n], wq) != 0)
+				status = 1;
+		goto cleanup;
+	}
+	if (num_keys && write_run(&runs, &num_runs, keys, num_keys) != 0)
+		goto nomem;
+
+	/* Merge the runs. */
+	for (n = 0; n < num_runs; n++)
+		next_key(&runs[n]);
+	for (;;) {
+		struct restore_run *min = NULL;
+
+		for (n = 0; n < num_runs; n++) {
+			if (runs[n].valid && (!min ||
+			    compare_keys(&runs[n].key, &min->key) < 0))
+				min = &runs[n];
+		}
+		if (!min)
+			break;
+		if (apply_key(in, filename, &min->key, wq) != 0)
+			status = 1;
+		next_key(min);
+	}
+	goto cleanup;
+
+nomem:
+	fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+	status = 1;
+
+cleanup:
+	for (n = 0; n < num_runs; n++)
+		fclose(runs[n].file);
+	free(runs);
+	free(keys);
+	return status;
+}
+
+int restore(const char *filename)
+{
+	struct work_queue *wq = NULL;
+	struct restore_record *rec;
+	struct input in;
+	int line = 0, status = 0, ret;
+
+	if (input_open(&in, filename, opt_inode_order ? INPUT_SPOOL : 0)) {
+		fprintf(stderr, "%s: %s: %s\n",
+			progname, filename, strerror_ea(errno));
+		return 1;
+	}
+	if (strcmp(filename, "-") == 0)
+		restore_filename = _("standard input");
+	else
+		restore_filename = filename;
+
+	if (opt_journal) {
+		if (open_journal(opt_journal, filename) != 0) {
+			if (errno)
+				fprintf(stderr, "%s: %s: %s\n", progname,
+					opt_journal, strerror(errno));
+			else
+				fprintf(stderr, _("%s: %s: Journal does not "
+						  "match the input\n"),
+					progname, opt_journal);
+			status = 1;
+			goto cleanup;
+		}
+		if (input_seek(&in, journal_resume_point(&line)) != 0) {
+			fprintf(stderr, _("%s: %s: Journal does not match "
+					  "the input\n"),
+				progname, opt_journal);
+			status = 1;
+			goto cleanup;
+		}
+	}
+
+	if (opt_jobs > 1) {
+		wq = create_queue(opt_jobs, RESTORE_QUEUE_SIZE,
+				  WORK_QUEUE_KEYED, apply_record, NULL);
+		if (!wq) {
+			fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+			status = 1;
+			goto cleanup;
+		}
+	}
+
+	if (opt_inode_order)
+		status = restore_sorted(&in, filename, line, wq);
+	else {
+		while ((ret = read_record(&in, filename, &line, &rec)) > 0) {
+			if (journal_has(rec->offset))
+				free_record(rec);
+			else
+				dispatch_record(wq, rec);
+		}
+		if (ret < 0)
+			status = 1;
+	}
+
+cleanup:
+	if (wq)
+		work_queue_finish(wq);
+	if (journal)
+		close_journal();
+	input_close(&in);
+	if (status)
+		had_errors++;
+	return status;
+}
+
+/*
+ * With --batch, commands are read from standard input, one per line:
+ *
+ *	set PATH NAME [VALUE]
+ *	remove PATH NAME
+ *
+ * The fields are separated by whitespace. PATH and NAME use the same
+ * escapes as getfattr output (\040 for a space, for example); VALUE is
+ * the rest of the line, and is encoded as for the -v option. With --null,
+ * each field is terminated by '\0' instead, PATH and NAME are used as they
+ * are, and set commands always have a VALUE field.
+ *
+ * For each command, a line "N ERRNO MESSAGE" is written to standard
+ * output, where N counts the commands starting from 1 and ERRNO is 0 on
+ * success. Consecutive commands for the same path share one open file.
+ */
+struct batch_command {
+	int remove;
+	char *path, *name;
+	size_t path_size, name_size;
+	const char *value;  /* points into the input */
+	size_t value_len;
+};
+
+static int batch_copy(char **buf, size_t *size, const char *str, size_t len)
+{
+	if (high_water_alloc((void **)buf, size, len + 1))
+		return -1;
+	memcpy(*buf, str, len);
+	(*buf)[len] = '\0';
+	return 0;
+}
 
-const char *strerror_ea(int err)
+static const char *batch_field(const char **l, const char *end, size_t *len)
 {
-#ifdef __linux__
-	/* The Linux kernel does not define ENOATTR, but maps it to ENODATA. */
-	if (err == ENODATA)
-		return _("No such attribute");
-#endif
-	return strerror(err);
+	const char *start;
+
+	while (*l < end && isspace(**l))
+		(*l)++;
+	start = *l;
+	while (*l < end && !isspace(**l))
+		(*l)++;
+	*len = *l - start;
+	return *len ? start : NULL;
 }
 
-static const char *xquote(const char *str, const char *quote_chars)
+static int batch_op(struct batch_command *cmd, const char *op, size_t len)
 {
-	const char *q = quote(str, quote_chars);
-	if (q == NULL) {
-		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
-		exit(1);
+	if (len == 3 && memcmp(op, "set", 3) == 0)
+		cmd->remove = 0;
+	else if (len == 6 && memcmp(op, "remove", 6) == 0)
+		cmd->remove = 1;
+	else
+		return -1;
+	return 0;
+}
+
+/*
+ * Read the next command. Returns 1 for a command, 0 at the end of the
+ * input, -1 on read errors, and -2 for invalid commands.
+ */
+static int batch_read_line(struct input *in, struct batch_command *cmd)
+{
+	const char *l, *end, *field;
+	size_t len;
+	int ret;
+
+	while ((ret = input_next_line(in, &l, &len)) > 0 && len == 0)
+		;
+	if (ret <= 0)
+		return ret;
+	end = l + len;
+
+	field = batch_field(&l, end, &len);
+	if (!field || batch_op(cmd, field, len) != 0)
+		return -2;
+	field = batch_field(&l, end, &len);
+	if (!field || batch_copy(&cmd->path, &cmd->path_size, field, len))
+		return field ? -1 : -2;
+	unquote(cmd->path);
+	field = batch_field(&l, end, &len);
+	if (!field || batch_copy(&cmd->name, &cmd->name_size, field, len))
+		return field ? -1 : -2;
+	unquote(cmd->name);
+
+	while (l < end && isspace(*l))
+		l++;
+	cmd->value = NULL;
+	if (l < end) {
+		if (cmd->remove)
+			return -2;
+		cmd->value = l;
+		cmd->value_len = end - l;
 	}
-	return q;
+	return 1;
 }
 
-int do_setxattr(const char *path, const char *name,
-		const void *value, size_t size)
+static int batch_read_null(struct input *in, struct batch_command *cmd)
 {
-	return (opt_deref ? setxattr : lsetxattr)(path, name, value, size, 0);
+	const char *l;
+	size_t len;
+	int field, ret;
+
+	for (field = 0; ; field++) {
+		ret = input_next_line(in, &l, &len);
+		if (ret < 0)
+			return -1;
+		if (ret == 0)  /* a command cut short is invalid */
+			return field ? -2 : 0;
+		switch (field) {
+			case 0:
+				if (batch_op(cmd, l, len) != 0)
+					return -2;
+				break;
+
+			case 1:
+				if (batch_copy(&cmd->path, &cmd->path_size,
+					       l, len))
+					return -1;
+				break;
+
+			case 2:
+				if (batch_copy(&cmd->name, &cmd->name_size,
+					       l, len))
+					return -1;
+				cmd->value = NULL;
+				if (cmd->remove)
+					return 1;
+				break;
+
+			default:
+				cmd->value = l;
+				cmd->value_len = len;
+				return 1;
+		}
+	}
 }
 
-int do_removexattr(const char *path, const char *name)
+static void batch_status(struct output *out, unsigned long n, int err,
+			 char delim)
 {
-	return (opt_deref ? removexattr : lremovexattr)(path, name);
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%lu %d ", n, err);
+	if (output_puts(out, buf) != 0 ||
+	    output_puts(out, strerror_ea(err)) != 0 ||
+	    output_write(out, &delim, 1) != 0) {
+		perror(progname);
+		exit(1);
+	}
+	if (err)
+		had_errors++;
 }
 
-int restore(const char *filename)
+static int batch_apply(const struct batch_command *cmd, int *fd,
+		       char **fd_path, size_t *fd_path_size)
 {
-	static char *path;
-	static size_t path_size;
-	FILE *file;
-	char *l;
-	int line = 0, backup_line, status = 0;
-	
-	if (strcmp(filename, "-") == 0)
-		file = stdin;
-	else {
-		file = fopen(filename, "r");
-		if (file == NULL) {
-				fprintf(stderr, "%s: %s: %s\n",
-					progname, filename, strerror_ea(errno));
-				return 1;
+	const char *value = NULL;
+	size_t size = 0;
+
+	if (*fd >= 0 && strcmp(*fd_path, cmd->path) != 0) {
+		close(*fd);
+		*fd = -1;
+	}
+	if (*fd < 0) {
+		*fd = open_path(cmd->path);
+		if (*fd < 0)
+			return errno;
+		if (batch_copy(fd_path, fd_path_size, cmd->path,
+			       strlen(cmd->path))) {
+			close(*fd);
+			*fd = -1;
+			return errno;
 		}
 	}
 
-	for(;;) {
-		backup_line = line;
-		while ((l = next_line(file)) != NULL && *l == '\0')
-			line++;
-		if (l == NULL)
+	if (cmd->remove) {
+		rate_limit(1, 0);
+		if (attr_removexattrat(*fd, "", AT_EMPTY_PATH, cmd->name) < 0)
+			return errno;
+		return 0;
+	}
+	if (cmd->value) {
+		size = cmd->value_len;
+		value = decode(cmd->value, &size);
+		if (!value)
+			return EINVAL;
+	}
+	rate_limit(1, size);
+	if (attr_setxattrat(*fd, "", AT_EMPTY_PATH, cmd->name, value, size,
+			    0) < 0)
+		return errno;
+	return 0;
+}
+
+int batch(void)
+{
+	struct batch_command cmd;
+	struct input in;
+	struct output out;
+	char *fd_path = NULL;
+	size_t fd_path_size = 0;
+	unsigned long n = 0;
+	char delim = opt_null ? '\0' : '\n';
+	int fd = -1, ret;
+
+	memset(&cmd, 0, sizeof(cmd));
+	if (input_open(&in, NULL, opt_null ? INPUT_NUL : 0) != 0 ||
+	    output_open(&out, NULL) != 0) {
+		perror(progname);
+		return 1;
+	}
+
+	for (;;) {
+		/* Let the other side see all results before we block. */
+		if (input_buffered(&in) == 0 && output_flush(&out) != 0)
 			break;
-		line++;
-		if (strncmp(l, "# file: ", 8) != 0) {
-			if (filename) {
-				fprintf(stderr, _("%s: %s: No filename found "
-				                  "in line %d, aborting\n"),
-					progname, filename, backup_line);
-			} else {
-				fprintf(stderr, _("%s: No filename found in "
-			                          "line %d of standard input, "
-						  "aborting\n"),
-					  progname, backup_line);
-			}
-			status = 1;
-			goto cleanup;
-		} else
-			l += 8;
-		l = unquote(l);
-		if (high_water_alloc((void **)&path, &path_size, strlen(l)+1)) {
-			perror(progname);
-			status = 1;
-			goto cleanup;
-		}
-		strcpy(path, l);
-
-		while ((l = next_line(file)) != NULL && *l != '\0') {
-			char *name = l, *value = strchr(l, '=');
-			line++;
-			if (value)
-				*value++ = '\0';
-			status = do_set(path, unquote(name), value);
-		}
-		if (l == NULL)
+		ret = opt_null ? batch_read_null(&in, &cmd) :
+				 batch_read_line(&in, &cmd);
+		if (ret == 0)
 			break;
-		line++;
-	}
-	if (!feof(file)) {
-		fprintf(stderr, "%s: %s: %s\n", progname, filename,
-			strerror(errno));
-		if (!status)
-			status = 1;
+		n++;
+		if (ret == -2)
+			batch_status(&out, n, EINVAL, delim);
+		else if (ret < 0) {
+			batch_status(&out, n, errno, delim);
+			break;
+		} else
+			batch_status(&out, n, batch_apply(&cmd, &fd, &fd_path,
+							  &fd_path_size),
+				     delim);
 	}
 
-cleanup:
-	if (path)
-		free(path);
-	if (file != stdin)
-		fclose(file);
-	if (status)
+	if (fd >= 0)
+		close(fd);
+	free(fd_path);
+	free(cmd.path);
+	free(cmd.name);
+	input_close(&in);
+	if (output_close(&out) != 0) {
+		perror(progname);
 		had_errors++;
-	return status;
+	}
+	return had_errors ? 1 : 0;
 }
 
 void help(void)
@@ -175,19 +1368,42 @@ void help(void)
 	printf(_("%s %s -- set extended attributes\n"), progname, VERSION);
 	printf(_("Usage: %s %s\n"), progname, CMD_LINE_SPEC1);
 	printf(_("       %s %s\n"), progname, CMD_LINE_SPEC2);
+	printf(_("       %s %s\n"), progname, CMD_LINE_SPEC3);
 	printf(_(
 "  -n, --name=name         set the value of the named extended attribute\n"
 "  -x, --remove=name       remove the named extended attribute\n"
 "  -v, --value=value       use value as the attribute value\n"
 "  -h, --no-dereference    do not dereference symbolic links\n"
+"  -R, --recursive         recurse into subdirectories\n"
+"  -L, --logical           logical walk, follow symbolic links\n"
+"  -P  --physical          physical walk, do not follow symbolic links\n"
 "      --restore=file      restore extended attributes\n"
+"      --jobs=n            restore or recurse using n threads; with\n"
+"                          min-max or auto, adapt to the filesystem\n"
+"      --incremental       only restore values which differ\n"
+"      --prune             also remove attributes not in the dump\n"
+"      --inode-order       restore files in inode order\n"
+"      --journal=file      record restore progress in file\n"
+"      --resume            continue the restore recorded in the journal\n"
+"      --batch             read set and remove commands from stdin\n"
+"      --files-from=file   read the names of the files from file\n"
+"  -0, --null              names in --files-from and batch fields are\n"
+"                          terminated by NUL\n"
+"      --remove-matching=regex  remove the attributes matching regex\n"
+"      --rename=old:new    rename attribute old to new\n"
+"      --max-ops-per-sec=n limit system calls to n per second\n"
+"      --max-bytes-per-sec=n\n"
+"                          limit attribute data written to n bytes per\n"
+"                          second (n may end in k, M or G)\n"
+"      --idle              run with idle I/O and CPU priority\n"
 "      --version           print version and exit\n"
 "      --help              this help text\n"));
 }
 
 int main(int argc, char *argv[])
 {
-	int opt;
+	const char **restore_files;
+	int opt, n, num_restore_files = 0;
 
 	progname = basename(argv[0]);
 
@@ -196,6 +1412,13 @@ int main(int argc, char *argv[])
 	bindtextdomain(PACKAGE, LOCALEDIR);
 	textdomain(PACKAGE);
 
+	restore_files = malloc(argc * sizeof(*restore_files));
+	renames = malloc(argc * sizeof(*renames));
+	if (!restore_files || !renames) {
+		perror(progname);
+		return 1;
+	}
+
 	while ((opt = getopt_long(argc, argv, CMD_LINE_OPTIONS,
 		                  long_options, NULL)) != -1) {
 		switch(opt) {
@@ -208,6 +1431,21 @@ int main(int argc, char *argv[])
 
 			case 'h':  /* set attribute on symlink itself */
 				opt_deref = 0;
+				walk_flags &= ~WALK_TREE_DEREFERENCE;
+				break;
+
+			case 'L':
+				walk_flags |= WALK_TREE_LOGICAL;
+				walk_flags &= ~WALK_TREE_PHYSICAL;
+				break;
+
+			case 'P':
+				walk_flags |= WALK_TREE_PHYSICAL;
+				walk_flags &= ~WALK_TREE_LOGICAL;
+				break;
+
+			case 'R':
+				walk_flags |= WALK_TREE_RECURSIVE;
 				break;
 
 			case 'v':  /* attribute value */
@@ -225,7 +1463,85 @@ int main(int argc, char *argv[])
 
 			case 'B':  /* restore */
 				opt_restore = 1;
-				restore(optarg);
+				restore_files[num_restore_files++] = optarg;
+				break;
+
+			case 'j': {  /* worker threads */
+				unsigned int max;
+
+				if (work_queue_parse_threads(optarg,
+						&opt_min_jobs, &max) != 0)
+					goto synopsis;
+				opt_jobs = max;
+				break;
+			}
+
+			case 'I':  /* skip unchanged values */
+				opt_incremental = 1;
+				break;
+
+			case 'X':  /* remove attributes not in the dump */
+				opt_incremental = 1;
+				opt_prune = 1;
+				break;
+
+			case 'S':  /* restore in inode order */
+				opt_inode_order = 1;
+				break;
+
+			case 'J':  /* restore journal */
+				opt_journal = optarg;
+				break;
+
+			case 'r':  /* resume from journal */
+				opt_resume = 1;
+				break;
+
+			case 'b':  /* batch mode */
+				opt_batch = 1;
+				break;
+
+			case '0':  /* NUL terminated fields and names */
+				opt_null = 1;
+				break;
+
+			case 'F':  /* read file names from file */
+				opt_files_from = optarg;
+				break;
+
+			case 'M':  /* remove attributes matching regex */
+				opt_remove_matching = optarg;
+				break;
+
+			case 'N': {  /* rename attribute */
+				char *colon = strchr(optarg, ':');
+
+				/* Names containing ':' can use "\072". */
+				if (!colon || colon == optarg || !colon[1])
+					goto synopsis;
+				*colon = '\0';
+				renames[num_renames].from = unquote(optarg);
+				renames[num_renames].to = unquote(colon + 1);
+				num_renames++;
+				break;
+			}
+
+			case 'o':  /* operations per second */
+				if (rate_limit_parse(optarg, &opt_max_ops) != 0)
+					goto synopsis;
+				break;
+
+			case 'w':  /* bytes per second */
+				if (rate_limit_parse(optarg,
+						     &opt_max_bytes) != 0)
+					goto synopsis;
+				break;
+
+			case 'i':  /* background priority */
+				if (rate_limit_idle() != 0) {
+					perror(progname);
+					return 1;
+				}
 				break;
 
 			case 'V':
@@ -240,36 +1556,70 @@ int main(int argc, char *argv[])
 				goto synopsis;
 		}
 	}
-	if (!(((opt_remove || opt_set) && optind < argc) || opt_restore))
+	if (!(((opt_remove || opt_set || opt_remove_matching ||
+		num_renames) && (optind < argc || opt_files_from)) ||
+	      opt_restore || opt_batch))
+		goto synopsis;
+	if ((opt_remove || opt_set) && (opt_remove_matching || num_renames))
 		goto synopsis;
+	/* A journal describes one input file. */
+	if ((opt_journal && num_restore_files != 1) ||
+	    (opt_resume && !opt_journal))
+		goto synopsis;
+
+	if (opt_remove_matching &&
+	    name_match_compile(&remove_matcher, opt_remove_matching) != 0) {
+		fprintf(stderr, _("%s: invalid regular expression \"%s\"\n"),
+			progname, opt_remove_matching);
+		return 1;
+	}
+
+	rate_limit_set(opt_max_ops, opt_max_bytes);
+
+	/* Restore after all options are known. */
+	for (n = 0; n < num_restore_files; n++)
+		restore(restore_files[n]);
+	if (opt_batch)
+		batch();
 
-	while (optind < argc) {
-		do_set(argv[optind], unquote(opt_name), opt_value);
-		optind++;
+	if ((opt_remove_matching || num_renames) &&
+	    (optind < argc || opt_files_from))
+		do_set_files(argv + optind, argc - optind, opt_files_from,
+			     NULL, NULL, 0);
+	else if ((opt_set || opt_remove) &&
+		 (optind < argc || opt_files_from)) {
+		const char *name = unquote(opt_name), *value = NULL;
+		size_t size = 0;
+
+		/* Decode the value once for all files. */
+		if (opt_value) {
+			size = strlen(opt_value);
+			value = decode(opt_value, &size);
+			if (!value)
+				return 1;
+		}
+		do_set_files(argv + optind, argc - optind, opt_files_from,
+			     name, value, size);
 	}
 
 	return (had_errors ? 1 : 0);
 
 synopsis:
 	fprintf(stderr, _("Usage: %s %s\n"
+			  "       %s %s\n"
 			  "       %s %s\n"
 	                  "Try `%s --help' for more information.\n"),
-		progname, CMD_LINE_SPEC1, progname, CMD_LINE_SPEC2, progname);
+		progname, CMD_LINE_SPEC1, progname, CMD_LINE_SPEC2,
+		progname, CMD_LINE_SPEC3, progname);
 	return 2;
 }
 
-int do_set(const char *path, const char *name, const char *value)
+int do_set(const char *path, const char *name, const void *value,
+	   size_t size)
 {
-	size_t size = 0;
 	int error;
 
-	if (value) {
-		size = strlen(value);
-		value = decode(value, &size);
-		if (!value)
-			return 1;
-	}
-	if (opt_set || opt_restore)
+	if (opt_set)
 		error = do_setxattr(path, name, value, size);
 	else
 		error = do_removexattr(path, name);
@@ -283,181 +1633,321 @@ int do_set(const char *path, const char *name, const char *value)
 	return 0;
 }
 
-const char *decode(const char *value, size_t *size)
+/*
+ * With -R, walk_tree() hands each file to apply_path(), which opens it
+ * and sets or removes the attribute through the file descriptor. With
+ * --jobs, the paths are queued to a pool of threads and the walk goes on
+ * while they are applied.
+ */
+struct set_op {
+	const char *name;
+	const void *value;
+	size_t size;
+	struct work_queue *wq;
+};
+
+static void set_error(const char *path)
 {
-	static char *decoded;
-	static size_t decoded_size;
+	int err = errno;
+
+	pthread_mutex_lock(&error_lock);
+	fprintf(stderr, "%s: %s: %s\n",
+		progname, xquote(path, "\n\r"), strerror_ea(err));
+	had_errors++;
+	pthread_mutex_unlock(&error_lock);
+}
 
-	if (value[0] == '0' && (value[1] == 'x' || value[1] == 'X')) {
-		const char *v = value+2, *end = value + *size;
-		char *d;
+/*
+ * With --remove-matching and --rename, the names of each file are listed
+ * first, and the file is only opened when one of them matches. The values
+ * of all attributes to rename are read before any new name is set, so
+ * that renames can swap names, and an old name is only removed after its
+ * new name has been set, so that the value is not lost when setting
+ * fails. Old names which are also the new name of another rename are
+ * kept.
+ */
+struct pending_rename {
+	const struct rename *rename;
+	char *value;
+	ssize_t size;
+	int done;
+};
 
-		if (high_water_alloc((void **)&decoded, &decoded_size,
-				     *size / 2)) {
-			fprintf(stderr, "%s: %s\n",
-				progname, strerror_ea(errno));
-			had_errors++;
-			return NULL;
-		}
-		d = decoded;
-		while (v < end) {
-			int d1, d0;
+static const struct rename *find_rename(const char *name)
+{
+	int n;
 
-			while (v < end && isspace(*v))
-				v++;
-			if (v == end)
-				break;
-			d1 = hex_digit(*v++);
-			while (v < end && isspace(*v))
-				v++;
-			if (v == end) {
-		bad_hex_encoding:
-				fprintf(stderr, "bad input encoding\n");
-				had_errors++;
-				return NULL;
+	/* Renaming to the same name does nothing. */
+	for (n = 0; n < num_renames; n++)
+		if (strcmp(renames[n].from, name) == 0 &&
+		    strcmp(renames[n].to, name) != 0)
+			return &renames[n];
+	return NULL;
+}
+
+static char *get_value(int fd, const char *name, ssize_t *size)
+{
+	size_t value_size = 256;
+	char *value = NULL, *v;
+
+	for (;;) {
+		v = realloc(value, value_size);
+		if (!v)
+			break;
+		value = v;
+		*size = attr_getxattrat(fd, "", AT_EMPTY_PATH, name, value,
+					value_size);
+		rate_limit(1, *size > 0 ? *size : 0);
+		if (*size >= 0)
+			return value;
+		if (errno != ERANGE)
+			break;
+		*size = attr_getxattrat(fd, "", AT_EMPTY_PATH, name, NULL, 0);
+		rate_limit(1, 0);
+		if (*size < 0)
+			break;
+		value_size = *size ? *size : 1;
+	}
+	free(value);
+	return NULL;
+}
+
+static int renamed_to(const struct pending_rename *pending,
+		      size_t num_pending, const char *name)
+{
+	size_t n;
+
+	for (n = 0; n < num_pending; n++)
+		if (pending[n].done && strcmp(pending[n].rename->to, name) == 0)
+			return 1;
+	return 0;
+}
+
+static void transform_path(const char *path)
+{
+	struct pending_rename *pending = NULL;
+	size_t num_pending = 0, n;
+	const char *l;
+	char *list;
+	ssize_t size;
+	int fd = -1;
+
+	/* Each system call counts towards --max-ops-per-sec. */
+	list = snapshot_names(AT_FDCWD, path,
+			      opt_deref ? 0 : AT_SYMLINK_NOFOLLOW, &size);
+	rate_limit(1, list ? size : 0);
+	if (!list) {
+		set_error(path);
+		return;
+	}
+	for (l = list; l < list + size; l += strlen(l) + 1) {
+		const struct rename *rename = find_rename(l);
+		struct pending_rename *p;
+
+		if (!rename && !(opt_remove_matching &&
+				 name_match(&remove_matcher, l, strlen(l))))
+			continue;
+		if (fd < 0) {
+			fd = open_path(path);
+			if (fd < 0) {
+				set_error(path);
+				goto out;
 			}
-			d0 = hex_digit(*v++);
-			if (d1 < 0 || d0 < 0)
-				goto bad_hex_encoding;
-			*d++ = ((d1 << 4) | d0);
 		}
-		*size = d - decoded;
-	} else if (value[0] == '0' && (value[1] == 's' || value[1] == 'S')) {
-		const char *v = value+2, *end = value + *size;
-		int d0, d1, d2, d3;
-		char *d;
-
-		if (high_water_alloc((void **)&decoded, &decoded_size,
-				     *size / 4 * 3)) {
-			fprintf(stderr, "%s: %s\n",
-				progname, strerror_ea(errno));
-			had_errors++;
-			return NULL;
+		if (!rename) {
+			rate_limit(1, 0);
+			if (attr_removexattrat(fd, "", AT_EMPTY_PATH, l) < 0)
+				set_error(path);
+			continue;
 		}
-		d = decoded;
-		for(;;) {
-			while (v < end && isspace(*v))
-				v++;
-			if (v == end) {
-				d0 = d1 = d2 = d3 = -2;
-				break;
-			}
-			if (v + 4 > end) {
-		bad_base64_encoding:
-				fprintf(stderr, "bad input encoding\n");
-				had_errors++;
-				return NULL;
+		/* Each name in the list matches a different rename. */
+		if (!pending) {
+			pending = calloc(num_renames, sizeof(*pending));
+			if (!pending) {
+				set_error(path);
+				goto out;
 			}
-			d0 = base64_digit(*v++);
-			d1 = base64_digit(*v++);
-			d2 = base64_digit(*v++);
-			d3 = base64_digit(*v++);
-			if (d0 < 0 || d1 < 0 || d2 < 0 || d3 < 0)
-				break;
-
-			*d++ = (char)((d0 << 2) | (d1 >> 4));
-			*d++ = (char)((d1 << 4) | (d2 >> 2));
-			*d++ = (char)((d2 << 6) | d3);
 		}
-		if (d0 == -2) {
-			if (d1 != -2 || d2 != -2 || d3 != -2)
-				goto bad_base64_encoding;
-			goto base64_end;
+		p = &pending[num_pending];
+		p->value = get_value(fd, l, &p->size);
+		if (!p->value) {
+			set_error(path);
+			continue;
 		}
-		if (d0 == -1 || d1 < 0 || d2 == -1 || d3 == -1)
-			goto bad_base64_encoding;
-		*d++ = (char)((d0 << 2) | (d1 >> 4));
-		if (d2 != -2)
-			*d++ = (char)((d1 << 4) | (d2 >> 2));
-		else {
-			if (d1 & 0x0F || d3 != -2)
-				goto bad_base64_encoding;
-			goto base64_end;
-		}
-		if (d3 != -2)
-			*d++ = (char)((d2 << 6) | d3);
-		else if (d2 & 0x03)
-			goto bad_base64_encoding;
-	base64_end:
-		while (v < end && isspace(*v))
-			v++;
-		if (v + 4 <= end && *v == '=') {
-			if (*++v != '=' || *++v != '=' || *++v != '=')
-				goto bad_base64_encoding;
-			v++;
-		}
-		while (v < end && isspace(*v))
-			v++;
-		if (v < end)
-			goto bad_base64_encoding;
-		*size = d - decoded;
-	} else {
-		const char *v = value, *end = value + *size;
-		char *d;
+		p->rename = rename;
+		num_pending++;
+	}
 
-		if (end > v+1 && *v == '"' && *(end-1) == '"') {
-			v++;
-			end--;
-		}
+	for (n = 0; n < num_pending; n++) {
+		struct pending_rename *p = &pending[n];
 
-		if (high_water_alloc((void **)&decoded, &decoded_size, *size)) {
-			fprintf(stderr, "%s: %s\n",
-				progname, strerror_ea(errno));
-			had_errors++;
-			return NULL;
-		}
-		d = decoded;
-
-		while (v < end) {
-			if (v[0] == '\\') {
-				if (v[1] == '\\' || v[1] == '"') {
-					*d++ = *++v; v++;
-				} else if (v[1] >= '0' && v[1] <= '7') {
-					int c = 0;
-					v++;
-					c = (*v++ - '0');
-					if (*v >= '0' && *v <= '7')
-						c = (c << 3) + (*v++ - '0');
-					if (*v >= '0' && *v <= '7')
-						c = (c << 3) + (*v++ - '0');
-					*d++ = c;
-				} else
-					*d++ = *v++;
-			} else
-				*d++ = *v++;
-		}
-		*size = d - decoded;
+		rate_limit(1, p->size);
+		if (attr_setxattrat(fd, "", AT_EMPTY_PATH, p->rename->to,
+				    p->value, p->size, 0) < 0)
+			set_error(path);
+		else
+			p->done = 1;
 	}
-	return decoded;
+	for (n = 0; n < num_pending; n++) {
+		struct pending_rename *p = &pending[n];
+
+		if (!p->done ||
+		    renamed_to(pending, num_pending, p->rename->from))
+			continue;
+		rate_limit(1, 0);
+		if (attr_removexattrat(fd, "", AT_EMPTY_PATH,
+				       p->rename->from) < 0)
+			set_error(path);
+	}
+
+out:
+	for (n = 0; n < num_pending; n++)
+		free(pending[n].value);
+	free(pending);
+	if (fd >= 0)
+		close(fd);
+	free(list);
+}
+
+static void apply_path(void *item, void *arg)
+{
+	struct set_op *op = arg;
+	char *path = item;
+	int fd, error;
+
+	if (opt_remove_matching || num_renames) {
+		transform_path(path);
+		goto out;
+	}
+	rate_limit(1, opt_set ? op->size : 0);
+	fd = open_path(path);
+	if (fd < 0) {
+		set_error(path);
+		goto out;
+	}
+	if (opt_set)
+		error = attr_setxattrat(fd, "", AT_EMPTY_PATH, op->name,
+					op->value, op->size, 0);
+	else
+		error = attr_removexattrat(fd, "", AT_EMPTY_PATH, op->name);
+	if (error < 0)
+		set_error(path);
+	close(fd);
+out:
+	free(path);
 }
 
-int hex_digit(char c)
+static void queue_path(struct set_op *op, const char *path)
 {
-	if (c >= '0' && c <= '9')
-		return c - '0';
-	else if (c >= 'A' && c <= 'F')
-		return c - 'A' + 10;
-	else if (c >= 'a' && c <= 'f')
-		return c - 'a' + 10;
+	char *p = strdup(path);
+
+	if (!p) {
+		set_error(path);
+		return;
+	}
+	if (op->wq)
+		work_queue_add(op->wq, p, 0);
 	else
-		return -1;
+		apply_path(p, op);
 }
 
-int base64_digit(char c)
+static int walk_set(const char *path, const struct stat *stat,
+		    int flags, void *arg)
 {
-	if (c >= 'A' && c <= 'Z')
-		return c - 'A';
-	else if (c >= 'a' && c <= 'z')
-		return 26 + c - 'a';
-	else if (c >= '0' && c <= '9')
-		return 52 + c - '0';
-	else if (c == '+')
-		return 62;
-	else if (c == '/')
-		return 63;
-	else if (c == '=')
-		return -2;
+	/*
+	 * Like setfacl, skip symlinks with -P, and symlinks below the top
+	 * level unless -L is given; they may point out of the tree.
+	 */
+	if ((flags & WALK_TREE_SYMLINK) &&
+	    ((flags & WALK_TREE_PHYSICAL) ||
+	     !(flags & (WALK_TREE_TOPLEVEL | WALK_TREE_LOGICAL))))
+		return 0;
+	if (flags & WALK_TREE_FAILED)
+		set_error(path);
 	else
-		return -1;
+		queue_path(arg, path);
+	return 0;
+}
+
+static void set_file(struct set_op *op, const char *path)
+{
+	if (walk_flags & WALK_TREE_RECURSIVE)
+		walk_tree(path, walk_flags, 0, walk_set, op);
+	else if (op->wq || opt_remove_matching || num_renames)
+		queue_path(op, path);
+	else
+		do_set(path, op->name, op->value, op->size);
+}
+
+/*
+ * Read the names of the files to modify from FILENAME, one per line, or
+ * terminated by '\0' with -0. Empty lines are skipped.
+ */
+static void set_files_from(struct set_op *op, const char *filename)
+{
+	struct input in;
+	char *path = NULL;
+	size_t size = 0;
+	int ret;
+
+	if (input_open(&in, filename, opt_null ? INPUT_NUL : 0) != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, filename,
+			strerror(errno));
+		had_errors++;
+		return;
+	}
+	while ((ret = input_next_name(&in, &path, &size)) > 0)
+		set_file(op, path);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, filename,
+			strerror(errno));
+		had_errors++;
+	}
+	input_close(&in);
+	free(path);
+}
+
+int do_set_files(char *paths[], int num_paths, const char *files_from,
+		 const char *name, const void *value, size_t size)
+{
+	struct set_op op = { name, value, size, NULL };
+	int n;
+
+	if (opt_jobs > 1) {
+		op.wq = create_queue(opt_jobs, WALK_QUEUE_SIZE, 0,
+				     apply_path, &op);
+		if (!op.wq) {
+			fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+			had_errors++;
+			return 1;
+		}
+	}
+	for (n = 0; n < num_paths; n++)
+		set_file(&op, paths[n]);
+	if (files_from)
+		set_files_from(&op, files_from);
+	if (op.wq)
+		work_queue_finish(op.wq);
+	return 0;
 }
 
+const char *decode(const char *value, size_t *size)
+{
+	static char *decoded;
+	static size_t decoded_size;
+	ssize_t len;
+
+	if (high_water_alloc((void **)&decoded, &decoded_size, *size + 1)) {
+		fprintf(stderr, "%s: %s\n", progname, strerror_ea(errno));
+		had_errors++;
+		return NULL;
+	}
+	len = decode_value(value, *size, decoded);
+	if (len < 0) {
+		fprintf(stderr, "bad input encoding\n");
+		had_errors++;
+		return NULL;
+	}
+	*size = len;
+	return decoded;
+}
@@ -0,0 +1,117 @@
+/*
+  File: attrd-op.c
+  (Linux Extended Attributes)
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Perform one extended attribute operation through attrd, for testing
+ * the daemon and the client functions of libattr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+
+#include <attr/attrd.h>
+
+const char *progname;
+
+static int fail(const char *path)
+{
+	fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct attrd_batch *batch;
+	struct attrd *attrd;
+	const char *socket_path = NULL, *path, *op;
+	const char *data, *p;
+	size_t size;
+	int opt, flags = 0, ret;
+
+	progname = basename(argv[0]);
+	while ((opt = getopt(argc, argv, "hs:")) != -1) {
+		switch(opt) {
+			case 'h':
+				flags = ATTRD_NOFOLLOW;
+				break;
+
+			case 's':
+				socket_path = optarg;
+				break;
+
+			default:
+				goto synopsis;
+		}
+	}
+	if (argc - optind < 2)
+		goto synopsis;
+	op = argv[optind];
+	path = argv[optind + 1];
+	argv += optind + 2;
+	argc -= optind + 2;
+
+	batch = attrd_batch_new();
+	if (!batch)
+		return fail(path);
+	if (strcmp(op, "get") == 0 && argc == 1)
+		ret = attrd_get(batch, path, argv[0], flags);
+	else if (strcmp(op, "set") == 0 && argc == 2)
+		ret = attrd_set(batch, path, argv[0], argv[1],
+				strlen(argv[1]), flags);
+	else if (strcmp(op, "remove") == 0 && argc == 1)
+		ret = attrd_remove(batch, path, argv[0], flags);
+	else if (strcmp(op, "list") == 0 && argc == 0)
+		ret = attrd_list(batch, path, flags);
+	else if (strcmp(op, "copy") == 0 && argc == 1)
+		ret = attrd_copy(batch, path, argv[0], flags);
+	else
+		goto synopsis;
+	if (ret < 0)
+		return fail(path);
+
+	attrd = attrd_connect(socket_path);
+	if (!attrd || attrd_run(attrd, batch) != 0) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		return 1;
+	}
+	if (attrd_result(batch, 0, (const void **)&data, &size) != 0)
+		return fail(path);
+	if (strcmp(op, "get") == 0)
+		printf("%.*s\n", (int)size, data);
+	else if (strcmp(op, "list") == 0) {
+		for (p = data; p < data + size; p += strlen(p) + 1)
+			if (strncmp(p, "user.", 5) == 0)
+				printf("%s\n", p);
+	}
+	attrd_disconnect(attrd);
+	attrd_batch_free(batch);
+	return 0;
+
+synopsis:
+	fprintf(stderr, "Usage: %s [-h] [-s socket] get path name\n"
+			"       %s [-h] [-s socket] set path name value\n"
+			"       %s [-h] [-s socket] remove path name\n"
+			"       %s [-h] [-s socket] list path\n"
+			"       %s [-h] [-s socket] copy path dst-path\n",
+		progname, progname, progname, progname, progname);
+	return 2;
+}
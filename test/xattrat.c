@@ -0,0 +1,122 @@
+/*
+  File: xattrat.c
+  (Linux Extended Attributes)
+
+  This program is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Perform one extended attribute operation relative to a directory file
+ * descriptor, for testing the *xattrat() interfaces of libattr. An empty
+ * path operates on the opened file itself (AT_EMPTY_PATH).
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+
+#include <attr/xattr.h>
+#include <attr/libattr.h>
+
+#define VALUE_MAX	65536
+
+const char *progname;
+
+static int at_flags(const char *path, int flags)
+{
+	return *path ? flags : flags | AT_EMPTY_PATH;
+}
+
+static int fail(const char *path)
+{
+	fprintf(stderr, "%s: %s: %s\n", progname, *path ? path : "\"\"",
+		strerror(errno));
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	static char buf[VALUE_MAX];
+	const char *path, *op;
+	int opt, flags = 0, dirfd, dst_dirfd;
+	ssize_t len;
+	char *p;
+
+	progname = basename(argv[0]);
+	while ((opt = getopt(argc, argv, "h")) != -1) {
+		switch(opt) {
+			case 'h':
+				flags = AT_SYMLINK_NOFOLLOW;
+				break;
+
+			default:
+				goto synopsis;
+		}
+	}
+	if (argc - optind < 3)
+		goto synopsis;
+	dirfd = open(argv[optind], O_RDONLY);
+	if (dirfd < 0)
+		return fail(argv[optind]);
+	path = argv[optind + 1];
+	op = argv[optind + 2];
+	argv += optind + 3;
+	argc -= optind + 3;
+	flags = at_flags(path, flags);
+
+	if (strcmp(op, "get") == 0 && argc == 1) {
+		len = attr_getxattrat(dirfd, path, flags, argv[0], buf,
+				      sizeof(buf));
+		if (len < 0)
+			return fail(path);
+		printf("%.*s\n", (int)len, buf);
+	} else if (strcmp(op, "set") == 0 && argc == 2) {
+		if (attr_setxattrat(dirfd, path, flags, argv[0], argv[1],
+				    strlen(argv[1]), 0) != 0)
+			return fail(path);
+	} else if (strcmp(op, "remove") == 0 && argc == 1) {
+		if (attr_removexattrat(dirfd, path, flags, argv[0]) != 0)
+			return fail(path);
+	} else if (strcmp(op, "list") == 0 && argc == 0) {
+		len = attr_listxattrat(dirfd, path, flags, buf, sizeof(buf));
+		if (len < 0)
+			return fail(path);
+		for (p = buf; p < buf + len; p += strlen(p) + 1)
+			if (strncmp(p, "user.", 5) == 0)
+				printf("%s\n", p);
+	} else if (strcmp(op, "copy") == 0 && argc == 2) {
+		dst_dirfd = open(argv[0], O_RDONLY);
+		if (dst_dirfd < 0)
+			return fail(argv[0]);
+		if (attr_copy_fileat(dirfd, path, dst_dirfd, argv[1], NULL,
+				     NULL) != 0)
+			return fail(argv[1]);
+	} else
+		goto synopsis;
+	return 0;
+
+synopsis:
+	fprintf(stderr, "Usage: %s [-h] dir path get name\n"
+			"       %s [-h] dir path set name value\n"
+			"       %s [-h] dir path remove name\n"
+			"       %s [-h] dir path list\n"
+			"       %s dir path copy dst-dir dst-path\n",
+		progname, progname, progname, progname, progname);
+	return 2;
+}